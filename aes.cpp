@@ -0,0 +1,213 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <string.h>
+
+#include <gcrypt.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_AESNI_INTRINSICS 1
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#endif
+
+#include "aes.hpp"
+
+
+namespace {
+
+
+    // Checks and strips the PKCS#7 padding; returns the unpadded size.
+    std::optional<std::size_t>
+    unpad(const std::uint8_t* buf,
+          std::size_t len)
+        noexcept
+    {
+        if (!len)
+            return {};
+        unsigned pad = buf[len - 1];
+        if (pad == 0 || pad > 16 || pad > len)
+            return {};
+        for (std::size_t i = len - pad; i < len; ++i)
+            if (buf[i] != pad)
+                return {};
+        return len - pad;
+    }
+
+
+#ifdef HAVE_AESNI_INTRINSICS
+
+
+    template<int rcon>
+    __attribute__((target("aes,sse2")))
+    __m128i
+    expand_key(__m128i key)
+    {
+        __m128i assist = _mm_aeskeygenassist_si128(key, rcon);
+        assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        return _mm_xor_si128(key, assist);
+    }
+
+
+    __attribute__((target("aes,sse2")))
+    void
+    aesni_decryption_keys(const std::uint8_t* key,
+                          std::uint8_t (&out)[11][16])
+    {
+        __m128i enc[11];
+        enc[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+        enc[1] = expand_key<0x01>(enc[0]);
+        enc[2] = expand_key<0x02>(enc[1]);
+        enc[3] = expand_key<0x04>(enc[2]);
+        enc[4] = expand_key<0x08>(enc[3]);
+        enc[5] = expand_key<0x10>(enc[4]);
+        enc[6] = expand_key<0x20>(enc[5]);
+        enc[7] = expand_key<0x40>(enc[6]);
+        enc[8] = expand_key<0x80>(enc[7]);
+        enc[9] = expand_key<0x1b>(enc[8]);
+        enc[10] = expand_key<0x36>(enc[9]);
+
+        // Equivalent inverse cipher: reversed order, InvMixColumns on the middle keys.
+        _mm_store_si128(reinterpret_cast<__m128i*>(out[0]), enc[10]);
+        for (int i = 1; i < 10; ++i)
+            _mm_store_si128(reinterpret_cast<__m128i*>(out[i]), _mm_aesimc_si128(enc[10 - i]));
+        _mm_store_si128(reinterpret_cast<__m128i*>(out[10]), enc[0]);
+
+        ::explicit_bzero(enc, sizeof enc);
+    }
+
+
+    __attribute__((target("aes,sse2")))
+    inline
+    __m128i
+    decrypt_block(__m128i block,
+                  const __m128i* rk)
+    {
+        block = _mm_xor_si128(block, rk[0]);
+        for (int i = 1; i < 10; ++i)
+            block = _mm_aesdec_si128(block, rk[i]);
+        return _mm_aesdeclast_si128(block, rk[10]);
+    }
+
+
+    // CBC decryption has no dependency between blocks, so 4 are kept in flight at once.
+    __attribute__((target("aes,sse2")))
+    void
+    aesni_cbc_decrypt(const std::uint8_t (&round_keys)[11][16],
+                      const std::uint8_t* iv,
+                      const std::uint8_t* in,
+                      std::size_t len,
+                      std::uint8_t* out)
+    {
+        __m128i rk[11];
+        for (int i = 0; i < 11; ++i)
+            rk[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(round_keys[i]));
+
+        auto load = [](const std::uint8_t* p)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        };
+        auto store = [](std::uint8_t* p, __m128i v)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+        };
+
+        __m128i prev = load(iv);
+        std::size_t i = 0;
+        for (; i + 64 <= len; i += 64) {
+            __m128i c0 = load(in + i);
+            __m128i c1 = load(in + i + 16);
+            __m128i c2 = load(in + i + 32);
+            __m128i c3 = load(in + i + 48);
+            __m128i p0 = decrypt_block(c0, rk);
+            __m128i p1 = decrypt_block(c1, rk);
+            __m128i p2 = decrypt_block(c2, rk);
+            __m128i p3 = decrypt_block(c3, rk);
+            store(out + i, _mm_xor_si128(p0, prev));
+            store(out + i + 16, _mm_xor_si128(p1, c0));
+            store(out + i + 32, _mm_xor_si128(p2, c1));
+            store(out + i + 48, _mm_xor_si128(p3, c2));
+            prev = c3;
+        }
+        for (; i < len; i += 16) {
+            __m128i c = load(in + i);
+            store(out + i, _mm_xor_si128(decrypt_block(c, rk), prev));
+            prev = c;
+        }
+
+        ::explicit_bzero(rk, sizeof rk);
+    }
+
+
+#endif // HAVE_AESNI_INTRINSICS
+
+
+} // namespace
+
+
+Aes128CbcDecryptor::Aes128CbcDecryptor(const Key& key) :
+    key{key},
+    use_aesni{has_aesni()}
+{
+#ifdef HAVE_AESNI_INTRINSICS
+    if (use_aesni)
+        aesni_decryption_keys(key.data(), round_keys);
+#endif
+}
+
+
+Aes128CbcDecryptor::~Aes128CbcDecryptor()
+{
+    ::explicit_bzero(key.data(), key.size());
+    ::explicit_bzero(round_keys, sizeof round_keys);
+}
+
+
+bool
+Aes128CbcDecryptor::has_aesni()
+    noexcept
+{
+#ifdef HAVE_AESNI_INTRINSICS
+    return __builtin_cpu_supports("aes");
+#else
+    return false;
+#endif
+}
+
+
+std::optional<std::size_t>
+Aes128CbcDecryptor::decrypt(const std::uint8_t* iv,
+                            const std::uint8_t* in,
+                            std::size_t len,
+                            std::uint8_t* out)
+    const
+{
+    if (!len || len % 16)
+        return {};
+
+#ifdef HAVE_AESNI_INTRINSICS
+    if (use_aesni) {
+        aesni_cbc_decrypt(round_keys, iv, in, len, out);
+        return unpad(out, len);
+    }
+#endif
+
+    // gcrypt handles can't be shared between threads, so each call opens its own.
+    gcry_cipher_hd_t hd;
+    if (gcry_cipher_open(&hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CBC, GCRY_CIPHER_SECURE))
+        return {};
+    bool ok = !gcry_cipher_setkey(hd, key.data(), key.size())
+        && !gcry_cipher_setiv(hd, iv, 16)
+        && !gcry_cipher_decrypt(hd, out, len, in, len);
+    gcry_cipher_close(hd);
+    if (!ok)
+        return {};
+    return unpad(out, len);
+}
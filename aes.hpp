@@ -0,0 +1,61 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef AES_HPP
+#define AES_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+
+/*
+ * AES-128-CBC decryption with PKCS#7 padding, as used by the Secret Service
+ * "dh-ietf1024-sha256-aes128-cbc-pkcs7" algorithm.
+ *
+ * Uses AES-NI when the CPU supports it, libgcrypt otherwise. A single object can be used
+ * from many threads at once.
+ */
+class Aes128CbcDecryptor {
+public:
+
+    using Key = std::array<std::uint8_t, 16>;
+
+
+    explicit
+    Aes128CbcDecryptor(const Key& key);
+
+
+    ~Aes128CbcDecryptor();
+
+
+    // Returns the size of the unpadded plaintext, or nothing if the input is invalid.
+    // `out` must have room for `len` bytes.
+    std::optional<std::size_t>
+    decrypt(const std::uint8_t* iv,
+            const std::uint8_t* in,
+            std::size_t len,
+            std::uint8_t* out)
+        const;
+
+
+    static
+    bool
+    has_aesni()
+        noexcept;
+
+private:
+
+    Key key;
+    bool use_aesni;
+    alignas(16) std::uint8_t round_keys[11][16]; // decryption round keys for AES-NI
+
+};
+
+
+#endif
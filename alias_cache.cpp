@@ -0,0 +1,109 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "alias_cache.hpp"
+#include "utils.hpp"
+
+
+bool
+AliasCache::matches(const std::string& service_bus,
+                    const std::vector<std::string>& service_collections,
+                    std::int64_t now)
+    const
+{
+    if (bus != service_bus || collections != service_collections)
+        return false;
+    if (now < time || now - time > alias_cache_ttl.count())
+        return false;
+    // an alias to a collection that is gone would be wrong anyway
+    for (auto& [alias, path] : aliases)
+        if (!std::binary_search(collections.begin(), collections.end(), path))
+            return false;
+    return true;
+}
+
+
+void
+AliasCache::write(const std::string& filename)
+    const
+{
+    std::filesystem::path dir = std::filesystem::path{filename}.parent_path();
+    if (!dir.empty())
+        std::filesystem::create_directories(dir);
+
+    // replace the cache atomically, so a concurrent run never reads half of it
+    std::string tmp = filename + ".tmp";
+    {
+        std::ofstream out{tmp, std::ios::trunc};
+        out << "lssecrets-aliases 1\n"
+            << "bus " << bus << '\n'
+            << "time " << time << '\n';
+        for (auto& path : collections)
+            out << "collection " << path << '\n';
+        for (auto& [alias, path] : aliases)
+            out << "alias " << alias << ' ' << path << '\n';
+        out.close();
+        if (!out)
+            throw std::runtime_error{"Couldn't write \"" + tmp + "\"."};
+    }
+    std::filesystem::rename(tmp, filename);
+}
+
+
+std::optional<AliasCache>
+AliasCache::read(const std::string& filename)
+{
+    std::ifstream in{filename};
+    if (!in)
+        return {};
+
+    std::string line;
+    if (!std::getline(in, line) || line != "lssecrets-aliases 1")
+        return {};
+
+    AliasCache result;
+    while (std::getline(in, line)) {
+        std::istringstream fields{line};
+        std::string kind;
+        fields >> kind;
+        if (kind == "bus") {
+            fields >> result.bus;
+        } else if (kind == "time") {
+            fields >> result.time;
+        } else if (kind == "collection") {
+            std::string path;
+            fields >> path;
+            result.collections.push_back(std::move(path));
+        } else if (kind == "alias") {
+            std::string alias, path;
+            fields >> alias >> path;
+            result.aliases[alias] = path;
+        } else
+            return {};
+        if (!fields)
+            return {};
+    }
+
+    if (!std::is_sorted(result.collections.begin(), result.collections.end()))
+        return {};
+    return result;
+}
+
+
+std::vector<std::string>
+get_collection_paths(SecretService* service)
+{
+    auto result = get_object_paths(G_DBUS_PROXY(service), "Collections");
+    std::sort(result.begin(), result.end());
+    return result;
+}
@@ -0,0 +1,66 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ALIAS_CACHE_HPP
+#define ALIAS_CACHE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <libsecret-1/libsecret/secret.h>
+
+
+/*
+ * Aliases of a service, as resolved on an earlier run. They are reused while the
+ * service's Collections property still lists the same paths, and the entry is younger
+ * than `alias_cache_ttl`; aliases can change without a collection being added or
+ * removed, and a one-shot client can't watch for that between runs.
+ */
+struct AliasCache {
+
+    std::string bus;
+    std::int64_t time = 0; // seconds since the epoch
+    std::vector<std::string> collections; // sorted
+    std::map<std::string, std::string> aliases;
+
+
+    bool
+    matches(const std::string& bus,
+            const std::vector<std::string>& collections,
+            std::int64_t now)
+        const;
+
+
+    void
+    write(const std::string& filename)
+        const;
+
+
+    // Returns nothing if the file doesn't exist or is not a valid cache.
+    static
+    std::optional<AliasCache>
+    read(const std::string& filename);
+
+};
+
+
+constexpr std::chrono::seconds alias_cache_ttl{600};
+
+
+/*
+ * Returns the sorted paths in the service's Collections property, from the proxy's
+ * property cache, without a D-Bus call.
+ */
+std::vector<std::string>
+get_collection_paths(SecretService* service);
+
+
+#endif
@@ -0,0 +1,300 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <gcrypt.h>
+
+#include "bulk_secrets.hpp"
+
+
+namespace {
+
+
+    // RFC 2409, section 6.2: the 1024-bit MODP group, generator 2.
+    const char ietf1024_prime[] =
+        "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD1"
+        "29024E088A67CC74020BBEA63B139B22514A08798E3404DD"
+        "EF9519B3CD3A431B302B0A6DF25F14374FE1356D6D51C245"
+        "E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+        "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE65381"
+        "FFFFFFFFFFFFFFFF";
+
+    constexpr std::size_t prime_bytes = 128;
+
+
+    struct MpiDeleter {
+        void
+        operator ()(gcry_mpi_t m)
+            const noexcept
+        {
+            gcry_mpi_release(m);
+        }
+    };
+
+    using Mpi = std::unique_ptr<std::remove_pointer_t<gcry_mpi_t>, MpiDeleter>;
+
+
+    struct VariantDeleter {
+        void
+        operator ()(GVariant* v)
+            const noexcept
+        {
+            g_variant_unref(v);
+        }
+    };
+
+    using Variant = std::unique_ptr<GVariant, VariantDeleter>;
+
+
+    Variant
+    child(GVariant* v,
+          gsize i)
+    {
+        return Variant{g_variant_get_child_value(v, i)};
+    }
+
+
+    void
+    hmac_sha256(const std::uint8_t* key,
+                std::size_t key_len,
+                const std::uint8_t* data,
+                std::size_t data_len,
+                std::uint8_t (&out)[32])
+    {
+        gcry_md_hd_t md;
+        if (gcry_md_open(&md, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC | GCRY_MD_FLAG_SECURE))
+            throw std::runtime_error{"Couldn't initialize HMAC-SHA256."};
+        gcry_md_setkey(md, key, key_len);
+        gcry_md_write(md, data, data_len);
+        std::memcpy(out, gcry_md_read(md, GCRY_MD_SHA256), 32);
+        gcry_md_close(md);
+    }
+
+
+    // HKDF-SHA256 (RFC 5869) with no salt and no info, as the Secret Service spec requires.
+    Aes128CbcDecryptor::Key
+    derive_key(const std::uint8_t* ikm,
+               std::size_t ikm_len)
+    {
+        const std::uint8_t zero_salt[32] = {};
+        std::uint8_t prk[32];
+        hmac_sha256(zero_salt, sizeof zero_salt, ikm, ikm_len, prk);
+
+        const std::uint8_t counter = 1;
+        std::uint8_t okm[32];
+        hmac_sha256(prk, sizeof prk, &counter, 1, okm);
+
+        Aes128CbcDecryptor::Key key;
+        std::memcpy(key.data(), okm, key.size());
+        ::explicit_bzero(prk, sizeof prk);
+        ::explicit_bzero(okm, sizeof okm);
+        return key;
+    }
+
+
+    struct Job {
+        std::string path;
+        Variant secret;                 // keeps the arrays below alive
+        const std::uint8_t* iv;
+        const std::uint8_t* data;
+        gsize len;
+        std::optional<BulkSecret> result;
+    };
+
+
+} // namespace
+
+
+BulkSecretFetcher::BulkSecretFetcher(SecretService* service) :
+    connection{g_dbus_proxy_get_connection(G_DBUS_PROXY(service)), true},
+    bus_name{g_dbus_proxy_get_name(G_DBUS_PROXY(service))},
+    service_path{g_dbus_proxy_get_object_path(G_DBUS_PROXY(service))}
+{
+    if (!gcry_check_version(GCRYPT_VERSION))
+        throw std::runtime_error{"libgcrypt version mismatch."};
+
+    gcry_mpi_t raw = nullptr;
+    if (gcry_mpi_scan(&raw, GCRYMPI_FMT_HEX, ietf1024_prime, 0, nullptr))
+        throw std::runtime_error{"Couldn't load the DH prime."};
+    Mpi prime{raw};
+    Mpi generator{gcry_mpi_set_ui(nullptr, 2)};
+
+    Mpi priv{gcry_mpi_snew(8 * prime_bytes)};
+    gcry_mpi_randomize(priv.get(), 8 * prime_bytes, GCRY_STRONG_RANDOM);
+    Mpi pub{gcry_mpi_new(8 * prime_bytes)};
+    gcry_mpi_powm(pub.get(), generator.get(), priv.get(), prime.get());
+
+    unsigned char* pub_bytes = nullptr;
+    std::size_t pub_len = 0;
+    if (gcry_mpi_aprint(GCRYMPI_FMT_USG, &pub_bytes, &pub_len, pub.get()))
+        throw std::runtime_error{"Couldn't export the DH public key."};
+    GVariant* input = g_variant_new_fixed_array(G_VARIANT_TYPE("y"),
+                                                pub_bytes, pub_len, 1);
+    gcry_free(pub_bytes);
+
+    GError* error = nullptr;
+    Variant reply{g_dbus_connection_call_sync(connection,
+                                              bus_name.c_str(),
+                                              service_path.c_str(),
+                                              "org.freedesktop.Secret.Service",
+                                              "OpenSession",
+                                              g_variant_new("(sv)",
+                                                            "dh-ietf1024-sha256-aes128-cbc-pkcs7",
+                                                            input),
+                                              G_VARIANT_TYPE("(vo)"),
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,
+                                              nullptr,
+                                              &error)};
+    if (error)
+        throw_error(error);
+
+    auto output_v = child(reply.get(), 0);
+    Variant output{g_variant_get_variant(output_v.get())};
+    auto path_v = child(reply.get(), 1);
+    session_path = g_variant_get_string(path_v.get(), nullptr);
+
+    gsize peer_len = 0;
+    auto peer_bytes = g_variant_get_fixed_array(output.get(), &peer_len, 1);
+    raw = nullptr;
+    if (gcry_mpi_scan(&raw, GCRYMPI_FMT_USG, peer_bytes, peer_len, nullptr))
+        throw std::runtime_error{"Invalid DH public key from the secret service."};
+    Mpi peer{raw};
+
+    Mpi shared{gcry_mpi_snew(8 * prime_bytes)};
+    gcry_mpi_powm(shared.get(), peer.get(), priv.get(), prime.get());
+
+    // The shared secret is zero-padded on the left to the size of the prime.
+    std::uint8_t ikm[prime_bytes] = {};
+    std::size_t shared_len = 0;
+    gcry_mpi_print(GCRYMPI_FMT_USG, nullptr, 0, &shared_len, shared.get());
+    if (shared_len > prime_bytes
+        || gcry_mpi_print(GCRYMPI_FMT_USG,
+                          ikm + prime_bytes - shared_len, shared_len,
+                          nullptr, shared.get()))
+        throw std::runtime_error{"Couldn't compute the DH shared secret."};
+
+    aes.emplace(derive_key(ikm, sizeof ikm));
+    ::explicit_bzero(ikm, sizeof ikm);
+}
+
+
+BulkSecretFetcher::~BulkSecretFetcher()
+{
+    GVariant* reply = g_dbus_connection_call_sync(connection,
+                                                  bus_name.c_str(),
+                                                  session_path.c_str(),
+                                                  "org.freedesktop.Secret.Session",
+                                                  "Close",
+                                                  nullptr,
+                                                  nullptr,
+                                                  G_DBUS_CALL_FLAGS_NONE,
+                                                  -1,
+                                                  nullptr,
+                                                  nullptr);
+    if (reply)
+        g_variant_unref(reply);
+}
+
+
+std::unordered_map<std::string, BulkSecret>
+BulkSecretFetcher::fetch(const std::vector<std::string>& item_paths)
+{
+    std::unordered_map<std::string, BulkSecret> result;
+    if (item_paths.empty())
+        return result;
+
+    std::vector<const gchar*> paths;
+    paths.reserve(item_paths.size());
+    for (auto& p : item_paths)
+        paths.push_back(p.c_str());
+
+    GError* error = nullptr;
+    Variant reply{g_dbus_connection_call_sync(connection,
+                                              bus_name.c_str(),
+                                              service_path.c_str(),
+                                              "org.freedesktop.Secret.Service",
+                                              "GetSecrets",
+                                              g_variant_new("(@aoo)",
+                                                            g_variant_new_objv(paths.data(),
+                                                                               paths.size()),
+                                                            session_path.c_str()),
+                                              G_VARIANT_TYPE("(a{o(oayays)})"),
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,
+                                              nullptr,
+                                              &error)};
+    if (error)
+        throw_error(error);
+
+    // Collect (iv, ciphertext) pointers straight from the reply, without copying.
+    auto dict = child(reply.get(), 0);
+    gsize n = g_variant_n_children(dict.get());
+    std::vector<Job> jobs(n);
+    std::size_t total_bytes = 0;
+    for (gsize i = 0; i < n; ++i) {
+        auto entry = child(dict.get(), i);
+        auto path = child(entry.get(), 0);
+        jobs[i].path = g_variant_get_string(path.get(), nullptr);
+        jobs[i].secret = child(entry.get(), 1);
+
+        auto params = child(jobs[i].secret.get(), 1);
+        auto value = child(jobs[i].secret.get(), 2);
+        gsize iv_len = 0;
+        jobs[i].iv = static_cast<const std::uint8_t*>(
+                         g_variant_get_fixed_array(params.get(), &iv_len, 1));
+        jobs[i].data = static_cast<const std::uint8_t*>(
+                           g_variant_get_fixed_array(value.get(), &jobs[i].len, 1));
+        if (iv_len != 16)
+            jobs[i].len = 0; // rejected by decrypt()
+        total_bytes += jobs[i].len;
+    }
+
+    std::atomic<std::size_t> next = 0;
+    auto worker = [this, &jobs, &next]
+    {
+        for (;;) {
+            std::size_t i = next++;
+            if (i >= jobs.size())
+                return;
+            auto& job = jobs[i];
+            SecureBuffer buf{job.len};
+            auto size = aes->decrypt(job.iv, job.data, job.len, buf.data());
+            if (!size)
+                continue;
+            buf.shrink(*size);
+            auto type = child(job.secret.get(), 3);
+            job.result = BulkSecret{g_variant_get_string(type.get(), nullptr),
+                                    std::move(buf)};
+        }
+    };
+
+    // Small secrets aren't worth waking up threads for.
+    constexpr std::size_t bytes_per_thread = 64 * 1024;
+    std::size_t num_threads = std::min<std::size_t>(std::thread::hardware_concurrency(),
+                                                    total_bytes / bytes_per_thread + 1);
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t t = 1; t < num_threads; ++t)
+            threads.emplace_back(worker);
+        worker();
+    }
+
+    for (auto& job : jobs)
+        if (job.result)
+            result.emplace(std::move(job.path), std::move(*job.result));
+
+    return result;
+}
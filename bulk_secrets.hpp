@@ -0,0 +1,62 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef BULK_SECRETS_HPP
+#define BULK_SECRETS_HPP
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <libsecret-1/libsecret/secret.h>
+
+#include "aes.hpp"
+#include "secure_buffer.hpp"
+#include "utils.hpp"
+
+
+struct BulkSecret {
+    std::string content_type;
+    SecureBuffer value;
+};
+
+
+/*
+ * Fetches secrets with a single GetSecrets call, through a
+ * "dh-ietf1024-sha256-aes128-cbc-pkcs7" session opened by lssecrets itself (libsecret
+ * doesn't expose its session key). Decryption runs on worker threads.
+ */
+class BulkSecretFetcher {
+public:
+
+    explicit
+    BulkSecretFetcher(SecretService* service);
+
+
+    BulkSecretFetcher(const BulkSecretFetcher&) = delete;
+
+
+    ~BulkSecretFetcher();
+
+
+    // Items that are locked, or whose secret couldn't be decrypted, are left out.
+    std::unordered_map<std::string, BulkSecret>
+    fetch(const std::vector<std::string>& item_paths);
+
+private:
+
+    GObjectWrapper<GDBusConnection> connection;
+    std::string bus_name;
+    std::string service_path;
+    std::string session_path;
+    std::optional<Aes128CbcDecryptor> aes;
+
+};
+
+
+#endif
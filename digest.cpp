@@ -0,0 +1,538 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "digest.hpp"
+#include "utils.hpp"
+
+
+namespace {
+
+
+    class Hasher {
+        GChecksum* checksum = nullptr;
+        GHmac* hmac = nullptr;
+
+    public:
+
+        explicit
+        Hasher(const std::string& key = {})
+        {
+            if (key.empty())
+                checksum = g_checksum_new(G_CHECKSUM_SHA256);
+            else
+                hmac = g_hmac_new(G_CHECKSUM_SHA256,
+                                  reinterpret_cast<const guchar*>(key.data()),
+                                  key.size());
+        }
+
+
+        Hasher(const Hasher&) = delete;
+
+
+        ~Hasher()
+        {
+            if (checksum)
+                g_checksum_free(checksum);
+            if (hmac)
+                g_hmac_unref(hmac);
+        }
+
+
+        void
+        update(const void* data,
+               std::size_t size)
+        {
+            auto ptr = static_cast<const guchar*>(data);
+            if (checksum)
+                g_checksum_update(checksum, ptr, size);
+            else
+                g_hmac_update(hmac, ptr, size);
+        }
+
+
+        void
+        update(const Hash& h)
+        {
+            update(h.data(), h.size());
+        }
+
+
+        // Strings are null-terminated, so consecutive fields can't be confused.
+        void
+        update(std::string_view s)
+        {
+            update(s.data(), s.size());
+            update("", 1);
+        }
+
+
+        Hash
+        finish()
+        {
+            Hash result;
+            gsize len = result.size();
+            if (checksum)
+                g_checksum_get_digest(checksum, result.data(), &len);
+            else
+                g_hmac_get_digest(hmac, result.data(), &len);
+            return result;
+        }
+    };
+
+
+    std::string
+    to_hex(const Hash& h)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string result;
+        result.reserve(2 * h.size());
+        for (auto b : h) {
+            result += digits[b >> 4];
+            result += digits[b & 0xf];
+        }
+        return result;
+    }
+
+
+    std::optional<Hash>
+    from_hex(std::string_view s)
+    {
+        Hash result;
+        if (s.size() != 2 * result.size())
+            return {};
+        auto nibble = [](char c) -> int
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            return -1;
+        };
+        for (std::size_t i = 0; i < result.size(); ++i) {
+            int hi = nibble(s[2 * i]);
+            int lo = nibble(s[2 * i + 1]);
+            if (hi < 0 || lo < 0)
+                return {};
+            result[i] = hi << 4 | lo;
+        }
+        return result;
+    }
+
+
+    // An HMAC of a fixed string, so the key itself can't be recovered from the file.
+    Hash
+    key_id_of(const std::string& key)
+    {
+        Hasher h{key};
+        h.update("lssecrets digest key");
+        return h.finish();
+    }
+
+
+    struct PendingItem {
+        GObjectWrapper<SecretItem> item;
+        DigestLeaf leaf;
+        bool fetch = false;
+    };
+
+
+    void
+    print_bucket_diff(const CollectionDigest& a,
+                      const CollectionDigest& b,
+                      std::size_t bucket,
+                      std::ostream& out)
+    {
+        auto i = a.leaves.begin() + a.bucket_start[bucket];
+        auto i_end = a.leaves.begin() + a.bucket_start[bucket + 1];
+        auto j = b.leaves.begin() + b.bucket_start[bucket];
+        auto j_end = b.leaves.begin() + b.bucket_start[bucket + 1];
+
+        while (i != i_end || j != j_end) {
+            if (j == j_end || (i != i_end && i->path < j->path)) {
+                out << "  - " << i->path << '\n';
+                ++i;
+            } else if (i == i_end || j->path < i->path) {
+                out << "  + " << j->path << '\n';
+                ++j;
+            } else {
+                if (i->leaf != j->leaf)
+                    out << "  ~ " << i->path << '\n';
+                ++i;
+                ++j;
+            }
+        }
+    }
+
+
+} // namespace
+
+
+std::size_t
+CollectionDigest::bucket_of(const std::string& item_path)
+    noexcept
+{
+    // FNV-1a, so the bucket doesn't depend on the standard library's hash
+    std::uint32_t h = 2166136261u;
+    for (unsigned char c : item_path) {
+        h ^= c;
+        h *= 16777619u;
+    }
+    return h % num_buckets;
+}
+
+
+void
+CollectionDigest::update()
+{
+    std::sort(leaves.begin(), leaves.end(),
+              [](const DigestLeaf& x, const DigestLeaf& y)
+              {
+                  auto bx = bucket_of(x.path);
+                  auto by = bucket_of(y.path);
+                  if (bx != by)
+                      return bx < by;
+                  return x.path < y.path;
+              });
+
+    std::size_t i = 0;
+    for (std::size_t b = 0; b < num_buckets; ++b) {
+        bucket_start[b] = i;
+        Hasher h;
+        for (; i < leaves.size() && bucket_of(leaves[i].path) == b; ++i)
+            h.update(leaves[i].leaf);
+        buckets[b] = h.finish();
+    }
+    bucket_start[num_buckets] = i;
+
+    Hasher h;
+    h.update(path);
+    for (auto& bucket : buckets)
+        h.update(bucket);
+    root = h.finish();
+}
+
+
+void
+ServiceDigest::update()
+{
+    std::sort(collections.begin(), collections.end(),
+              [](const CollectionDigest& x, const CollectionDigest& y)
+              {
+                  return x.path < y.path;
+              });
+    Hasher h;
+    for (auto& col : collections)
+        h.update(col.root);
+    root = h.finish();
+}
+
+
+void
+ServiceDigest::write(std::ostream& out)
+    const
+{
+    out << "lssecrets-digest 1\n"
+        << "service " << to_hex(root) << '\n';
+    out << "key " << to_hex(key_id) << '\n';
+    for (auto& col : collections) {
+        out << "collection " << to_hex(col.root) << ' ' << col.path << '\n';
+        for (auto& leaf : col.leaves)
+            out << "item "
+                << to_hex(leaf.leaf) << ' '
+                << to_hex(leaf.secret) << ' '
+                << leaf.modified << ' '
+                << leaf.path << '\n';
+    }
+}
+
+
+ServiceDigest
+ServiceDigest::read(const std::string& filename)
+{
+    std::ifstream in{filename};
+    if (!in)
+        throw std::runtime_error{"Couldn't open \"" + filename + "\"."};
+
+    auto bad = [&filename]
+    {
+        return std::runtime_error{"\"" + filename + "\" is not a valid digest file."};
+    };
+
+    std::string line;
+    if (!std::getline(in, line) || line != "lssecrets-digest 1")
+        throw bad();
+
+    ServiceDigest result;
+    std::optional<Hash> service_root;
+    std::vector<Hash> collection_roots;
+    while (std::getline(in, line)) {
+        std::istringstream fields{line};
+        std::string kind;
+        fields >> kind;
+        if (kind == "service") {
+            std::string hex;
+            fields >> hex;
+            service_root = from_hex(hex);
+            if (!service_root)
+                throw bad();
+        } else if (kind == "key") {
+            std::string hex;
+            fields >> hex;
+            auto h = from_hex(hex);
+            if (!h)
+                throw bad();
+            result.key_id = *h;
+        } else if (kind == "collection") {
+            std::string hex;
+            CollectionDigest col;
+            fields >> hex >> col.path;
+            auto h = from_hex(hex);
+            if (!h || col.path.empty())
+                throw bad();
+            collection_roots.push_back(*h);
+            result.collections.push_back(std::move(col));
+        } else if (kind == "item") {
+            if (result.collections.empty())
+                throw bad();
+            std::string leaf_hex;
+            std::string secret_hex;
+            DigestLeaf leaf;
+            fields >> leaf_hex >> secret_hex >> leaf.modified >> leaf.path;
+            auto leaf_h = from_hex(leaf_hex);
+            auto secret_h = from_hex(secret_hex);
+            if (!fields || !leaf_h || !secret_h)
+                throw bad();
+            leaf.leaf = *leaf_h;
+            leaf.secret = *secret_h;
+            result.collections.back().leaves.push_back(std::move(leaf));
+        } else if (!kind.empty()) {
+            throw bad();
+        }
+    }
+
+    // The stored roots must match the ones recomputed from the leaves.
+    for (std::size_t i = 0; i < result.collections.size(); ++i) {
+        result.collections[i].update();
+        if (result.collections[i].root != collection_roots[i])
+            throw bad();
+    }
+    result.update();
+    if (!service_root || result.root != *service_root)
+        throw bad();
+
+    return result;
+}
+
+
+std::string
+read_digest_key(const std::string& filename,
+                bool create)
+{
+    if (create && !std::filesystem::exists(filename)) {
+        std::filesystem::create_directories(std::filesystem::path{filename}.parent_path());
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd != -1) {
+            char key[32];
+            bool ok = ::getrandom(key, sizeof key, 0) == sizeof key
+                && ::write(fd, key, sizeof key) == sizeof key;
+            int e = errno;
+            ok = ::close(fd) == 0 && ok;
+            if (!ok) {
+                ::unlink(filename.c_str());
+                throw std::system_error{e, std::generic_category(), filename};
+            }
+        } else if (errno != EEXIST) // another run may have just created it
+            throw std::system_error{errno, std::generic_category(), filename};
+    }
+
+    std::ifstream in{filename, std::ios::binary};
+    if (!in)
+        throw std::runtime_error{"Couldn't read \"" + filename + "\"."};
+    std::string key{std::istreambuf_iterator<char>{in}, {}};
+    if (key.empty())
+        throw std::runtime_error{"\"" + filename + "\" is empty."};
+    return key;
+}
+
+
+ServiceDigest
+compute_digest(SecretService* service,
+               const ServiceDigest* cache,
+               const std::string& key,
+               bool unlock,
+               std::ostream& log)
+{
+    if (key.empty())
+        throw std::logic_error{"compute_digest() called without a key."};
+
+    ServiceDigest result;
+    result.key_id = key_id_of(key);
+
+    // secret digests made with another key, or without one, can't be reused
+    if (cache && cache->key_id != result.key_id) {
+        log << "Ignoring the digest cache, made with a different key.\n";
+        cache = nullptr;
+    }
+
+    std::unordered_map<std::string_view, const DigestLeaf*> cached;
+    if (cache)
+        for (auto& col : cache->collections)
+            for (auto& leaf : col.leaves)
+                cached.emplace(leaf.path, &leaf);
+
+    auto collections = to_vector<SecretCollection>(secret_service_get_collections(service));
+
+    if (unlock) {
+        GList* locked = nullptr;
+        for (auto& col : collections)
+            if (secret_collection_get_locked(col))
+                locked = g_list_prepend(locked, col.get());
+        if (locked) {
+            GError* error = nullptr;
+            secret_service_unlock_sync(service, locked, nullptr, nullptr, &error);
+            g_list_free(locked);
+            if (error)
+                log << "Error: " << to_error(error).what() << '\n';
+            while (g_main_context_iteration(nullptr, FALSE))
+                ;
+        }
+    }
+
+    std::size_t fetched = 0;
+    std::size_t reused = 0;
+
+    for (auto& col : collections) {
+        CollectionDigest col_digest;
+        col_digest.path = g_dbus_proxy_get_object_path(col);
+
+        std::vector<PendingItem> pending;
+        GList* fetch_list = nullptr;
+        for (auto& item : to_vector<SecretItem>(secret_collection_get_items(col))) {
+            PendingItem p;
+            p.item = item;
+            p.leaf.path = g_dbus_proxy_get_object_path(item);
+            p.leaf.modified = secret_item_get_modified(item);
+            auto hit = cached.find(p.leaf.path);
+            // a zero digest means the secret couldn't be read, so try again
+            if (hit != cached.end()
+                && hit->second->modified == p.leaf.modified
+                && hit->second->secret != Hash{}) {
+                p.leaf.secret = hit->second->secret;
+                ++reused;
+            } else if (!secret_item_get_locked(item)) {
+                p.fetch = true;
+                fetch_list = g_list_prepend(fetch_list, item.get());
+            }
+            pending.push_back(std::move(p));
+        }
+
+        if (fetch_list) {
+            GError* error = nullptr;
+            secret_item_load_secrets_sync(fetch_list, nullptr, &error);
+            g_list_free(fetch_list);
+            if (error)
+                log << "Error: " << col_digest.path << ": " << to_error(error).what() << '\n';
+        }
+
+        for (auto& p : pending) {
+            if (p.fetch) {
+                if (auto val = secret_item_get_secret(p.item)) {
+                    gsize len = 0;
+                    auto ptr = secret_value_get(val, &len);
+                    auto type = secret_value_get_content_type(val);
+                    Hasher h{key};
+                    h.update(type ? type : "");
+                    h.update(ptr, len);
+                    p.leaf.secret = h.finish();
+                    secret_value_unref(val);
+                    ++fetched;
+                }
+            }
+
+            Hasher h;
+            h.update(p.leaf.path);
+            h.update(to_string(secret_item_get_label(p.item)).value_or(""));
+            for (auto& [k, v] : to_map(secret_item_get_attributes(p.item))) {
+                h.update(k);
+                h.update(v);
+            }
+            h.update(std::to_string(p.leaf.modified));
+            h.update(p.leaf.secret);
+            p.leaf.leaf = h.finish();
+
+            col_digest.leaves.push_back(std::move(p.leaf));
+        }
+
+        col_digest.update();
+        result.collections.push_back(std::move(col_digest));
+    }
+    result.update();
+
+    log << "Digested "
+        << fetched + reused
+        << " secrets: "
+        << fetched
+        << " fetched, "
+        << reused
+        << " reused from cache.\n";
+
+    return result;
+}
+
+
+bool
+compare_digests(const ServiceDigest& a,
+                const ServiceDigest& b,
+                std::ostream& out)
+{
+    // the secret digests of different keys never match
+    if (a.key_id != b.key_id)
+        throw std::runtime_error{"The digests were made with different keys."};
+
+    if (a.root == b.root)
+        return true;
+
+    auto i = a.collections.begin();
+    auto j = b.collections.begin();
+    while (i != a.collections.end() || j != b.collections.end()) {
+        if (j == b.collections.end() || (i != a.collections.end() && i->path < j->path)) {
+            out << "- " << i->path << '\n';
+            ++i;
+        } else if (i == a.collections.end() || j->path < i->path) {
+            out << "+ " << j->path << '\n';
+            ++j;
+        } else {
+            if (i->root != j->root) {
+                out << "~ " << i->path << '\n';
+                for (std::size_t bucket = 0; bucket < CollectionDigest::num_buckets; ++bucket)
+                    if (i->buckets[bucket] != j->buckets[bucket])
+                        print_bucket_diff(*i, *j, bucket, out);
+            }
+            ++i;
+            ++j;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,112 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef DIGEST_HPP
+#define DIGEST_HPP
+
+#include <array>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <libsecret-1/libsecret/secret.h>
+
+
+using Hash = std::array<guint8, 32>;
+
+
+struct DigestLeaf {
+    std::string path;
+    guint64 modified = 0;
+    Hash secret{};              // digest of the secret alone; zero if it couldn't be read
+    Hash leaf{};                // digest of path, label, attributes, modified and secret
+};
+
+
+/*
+ * Items are spread over a fixed number of buckets by a hash of their path, so two trees
+ * for the same collection always have the same shape, and a comparison only descends
+ * into the buckets whose hashes differ.
+ */
+struct CollectionDigest {
+
+    static constexpr std::size_t num_buckets = 64;
+
+    std::string path;
+    std::vector<DigestLeaf> leaves; // sorted by bucket, then path
+    std::array<std::size_t, num_buckets + 1> bucket_start{};
+    std::array<Hash, num_buckets> buckets{};
+    Hash root{};
+
+
+    static
+    std::size_t
+    bucket_of(const std::string& item_path)
+        noexcept;
+
+
+    // Sorts the leaves and recomputes the bucket and root hashes.
+    void update();
+
+};
+
+
+struct ServiceDigest {
+
+    std::vector<CollectionDigest> collections; // sorted by path
+    Hash root{};
+    Hash key_id{};              // identifies the key; zero in files from older versions
+
+
+    void update();
+
+
+    void
+    write(std::ostream& out)
+        const;
+
+
+    static
+    ServiceDigest
+    read(const std::string& filename);
+
+};
+
+
+/*
+ * Reads the key that secrets are digested with. If `create` is true and the file doesn't
+ * exist, it's created (mode 0600, with its directory) holding 32 random bytes.
+ */
+std::string
+read_digest_key(const std::string& filename,
+                bool create);
+
+
+/*
+ * Computes the digest of every unlocked item. Items whose Modified timestamp matches
+ * the same path in `cache` reuse its secret digest instead of fetching the secret, unless
+ * that secret couldn't be read then. Secrets are digested with HMAC-SHA256 keyed by
+ * `key`, which must not be empty, so a digest can't be used to guess them. The cache is
+ * ignored if it was made with another key.
+ */
+ServiceDigest
+compute_digest(SecretService* service,
+               const ServiceDigest* cache,
+               const std::string& key,
+               bool unlock,
+               std::ostream& log);
+
+
+// Prints the differences between two digests; returns true if they're equal. Throws if
+// they were made with different keys.
+bool
+compare_digests(const ServiceDigest& a,
+                const ServiceDigest& b,
+                std::ostream& out);
+
+
+#endif
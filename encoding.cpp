@@ -0,0 +1,251 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_SSSE3_INTRINSICS 1
+#include <tmmintrin.h>
+#endif
+
+#include "encoding.hpp"
+
+
+namespace {
+
+
+    // Input bytes per chunk: a multiple of 3 (for base64) and of 12 (for the SIMD loop).
+    constexpr std::size_t chunk_size = 3 * 1024;
+
+
+    const char base64_alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    const char base64url_alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+
+    // Returns the number of characters written.
+    std::size_t
+    encode_hex(const std::uint8_t* in,
+               std::size_t len,
+               char* out)
+        noexcept
+    {
+        static const char digits[] = "0123456789abcdef";
+        for (std::size_t i = 0; i < len; ++i) {
+            out[2 * i]     = digits[in[i] >> 4];
+            out[2 * i + 1] = digits[in[i] & 0xf];
+        }
+        return 2 * len;
+    }
+
+
+    std::size_t
+    encode_base64_scalar(const std::uint8_t* in,
+                         std::size_t len,
+                         char* out,
+                         const char* alphabet,
+                         bool pad)
+        noexcept
+    {
+        char* start = out;
+        std::size_t i = 0;
+        for (; i + 3 <= len; i += 3) {
+            std::uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+            *out++ = alphabet[v >> 18];
+            *out++ = alphabet[(v >> 12) & 0x3f];
+            *out++ = alphabet[(v >> 6) & 0x3f];
+            *out++ = alphabet[v & 0x3f];
+        }
+        if (len - i == 1) {
+            std::uint32_t v = in[i] << 16;
+            *out++ = alphabet[v >> 18];
+            *out++ = alphabet[(v >> 12) & 0x3f];
+            if (pad) {
+                *out++ = '=';
+                *out++ = '=';
+            }
+        } else if (len - i == 2) {
+            std::uint32_t v = (in[i] << 16) | (in[i + 1] << 8);
+            *out++ = alphabet[v >> 18];
+            *out++ = alphabet[(v >> 12) & 0x3f];
+            *out++ = alphabet[(v >> 6) & 0x3f];
+            if (pad)
+                *out++ = '=';
+        }
+        return out - start;
+    }
+
+
+#ifdef HAVE_SSSE3_INTRINSICS
+
+
+    /*
+     * Wojciech Muła's SSSE3 encoder: each step loads 16 bytes and encodes the first 12
+     * of them into 16 characters. The shuffle puts each 3-byte group in a 32-bit lane,
+     * the multiplies move the four 6-bit fields into separate bytes, and a 16-entry
+     * table indexed by range gives the offset to add to each field.
+     */
+    __attribute__((target("ssse3")))
+    std::size_t
+    encode_base64_ssse3(const std::uint8_t* in,
+                        std::size_t len,
+                        char* out,
+                        bool url)
+        noexcept
+    {
+        const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1,
+                                              4, 3, 5, 4,
+                                              7, 6, 8, 7,
+                                              10, 9, 11, 10);
+        const __m128i offsets = _mm_setr_epi8('a' - 26,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52,
+                                              url ? '-' - 62 : '+' - 62,
+                                              url ? '_' - 63 : '/' - 63,
+                                              'A', 0, 0);
+
+        std::size_t done = 0;
+        for (; done + 16 <= len; done += 12) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+            v = _mm_shuffle_epi8(v, shuffle);
+
+            const __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+            const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+            const __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+            const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+            const __m128i indices = _mm_or_si128(t1, t3);
+
+            // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+            __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+            const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+            range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+
+            const __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), chars);
+            out += 16;
+        }
+
+        return done;
+    }
+
+
+    bool
+    have_ssse3()
+        noexcept
+    {
+        static const bool result = __builtin_cpu_supports("ssse3");
+        return result;
+    }
+
+
+#endif // HAVE_SSSE3_INTRINSICS
+
+
+    std::size_t
+    encode_base64(const std::uint8_t* in,
+                  std::size_t len,
+                  char* out,
+                  bool url)
+        noexcept
+    {
+        std::size_t done = 0;
+#ifdef HAVE_SSSE3_INTRINSICS
+        if (have_ssse3())
+            done = encode_base64_ssse3(in, len, out, url);
+#endif
+        std::size_t written = done / 3 * 4;
+        return written + encode_base64_scalar(in + done,
+                                              len - done,
+                                              out + written,
+                                              url ? base64url_alphabet : base64_alphabet,
+                                              !url);
+    }
+
+
+    // Encodes one chunk; returns the number of characters written.
+    std::size_t
+    encode_chunk(const std::uint8_t* in,
+                 std::size_t len,
+                 char* out,
+                 BinaryEncoding enc)
+        noexcept
+    {
+        switch (enc) {
+        case BinaryEncoding::Hex:
+            return encode_hex(in, len, out);
+        case BinaryEncoding::Base64:
+            return encode_base64(in, len, out, false);
+        case BinaryEncoding::Base64Url:
+            return encode_base64(in, len, out, true);
+        case BinaryEncoding::Raw:
+            break;
+        }
+        return 0;
+    }
+
+
+} // namespace
+
+
+const char*
+to_string(BinaryEncoding enc)
+    noexcept
+{
+    switch (enc) {
+    case BinaryEncoding::Hex:
+        return "hex";
+    case BinaryEncoding::Base64:
+        return "base64";
+    case BinaryEncoding::Base64Url:
+        return "base64url";
+    case BinaryEncoding::Raw:
+        return "raw";
+    }
+    return "?";
+}
+
+
+void
+append_encoded(std::string& out,
+               std::string_view data,
+               BinaryEncoding enc)
+{
+    if (enc == BinaryEncoding::Raw) {
+        out += data;
+        return;
+    }
+
+    auto in = reinterpret_cast<const std::uint8_t*>(data.data());
+    std::size_t old_size = out.size();
+    // enough for hex, and for the padding of short base64 input
+    out.resize(old_size + 2 * data.size() + 4);
+    std::size_t n = encode_chunk(in, data.size(), out.data() + old_size, enc);
+    out.resize(old_size + n);
+}
+
+
+void
+write_encoded(std::ostream& out,
+              std::string_view data,
+              BinaryEncoding enc)
+{
+    if (enc == BinaryEncoding::Raw) {
+        out.write(data.data(), data.size());
+        return;
+    }
+
+    char buf[2 * chunk_size];
+    auto in = reinterpret_cast<const std::uint8_t*>(data.data());
+    for (std::size_t pos = 0; pos < data.size(); pos += chunk_size) {
+        std::size_t len = std::min(chunk_size, data.size() - pos);
+        out.write(buf, encode_chunk(in + pos, len, buf, enc));
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ENCODING_HPP
+#define ENCODING_HPP
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+
+enum class BinaryEncoding {
+    Hex,
+    Base64,
+    Base64Url, // URL-safe alphabet, no padding
+    Raw
+};
+
+
+const char*
+to_string(BinaryEncoding enc)
+    noexcept;
+
+
+// Appends the encoding of data to out; Raw appends the bytes unchanged.
+void
+append_encoded(std::string& out,
+               std::string_view data,
+               BinaryEncoding enc);
+
+
+// Writes the encoding of data to out in fixed-size chunks, without building it in memory.
+void
+write_encoded(std::ostream& out,
+              std::string_view data,
+              BinaryEncoding enc);
+
+
+#endif
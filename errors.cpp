@@ -0,0 +1,128 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+
+#include "errors.hpp"
+#include "utils.hpp"
+
+
+void
+ErrorTable::add(GError* error,
+                std::string_view path)
+{
+    auto kind = intern(error->domain, error->code, error->message);
+    g_error_free(error);
+    records.push_back({kind, std::uint32_t(paths.size()), std::uint32_t(path.size())});
+    paths += path;
+}
+
+
+void
+ErrorTable::add(std::string_view message,
+                std::string_view path)
+{
+    auto kind = intern(0, 0, message);
+    records.push_back({kind, std::uint32_t(paths.size()), std::uint32_t(path.size())});
+    paths += path;
+}
+
+
+std::uint32_t
+ErrorTable::intern(GQuark domain,
+                   int code,
+                   std::string_view message)
+{
+    auto found = kind_ids.find(message);
+    if (found != kind_ids.end())
+        return found->second;
+
+    kinds.push_back({domain, code, std::string{message}});
+    std::uint32_t id = kinds.size() - 1;
+    kind_ids.emplace(kinds.back().message, id);
+    return id;
+}
+
+
+std::vector<ErrorTable::Record>
+ErrorTable::grouped(std::vector<std::size_t>& starts)
+    const
+{
+    auto sorted = records;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const Record& a, const Record& b)
+                     {
+                         return a.kind < b.kind;
+                     });
+    starts.assign(kinds.size() + 1, sorted.size());
+    for (std::size_t i = sorted.size(); i-- > 0;)
+        starts[sorted[i].kind] = i;
+    return sorted;
+}
+
+
+void
+ErrorTable::print_summary(std::ostream& out)
+    const
+{
+    if (records.empty())
+        return;
+
+    constexpr std::size_t max_paths = 10;
+
+    std::vector<std::size_t> starts;
+    auto sorted = grouped(starts);
+
+    out << "Errors: "
+        << records.size()
+        << " ("
+        << kinds.size()
+        << " distinct)\n";
+    for (std::size_t k = 0; k < kinds.size(); ++k) {
+        auto& kind = kinds[k];
+        std::size_t count = starts[k + 1] - starts[k];
+        out << "  "
+            << count
+            << " x ";
+        if (kind.domain)
+            out << describe_error(kind.domain, kind.code) << ' ';
+        out << kind.message << '\n';
+        for (std::size_t i = 0; i < count && i < max_paths; ++i)
+            out << "      " << path_of(sorted[starts[k] + i]) << '\n';
+        if (count > max_paths)
+            out << "      ... and " << count - max_paths << " more\n";
+    }
+}
+
+
+void
+ErrorTable::print_json(std::ostream& out)
+    const
+{
+    std::vector<std::size_t> starts;
+    auto sorted = grouped(starts);
+
+    std::string json = "{\"total\":" + std::to_string(records.size()) + ",\"errors\":[";
+    for (std::size_t k = 0; k < kinds.size(); ++k) {
+        auto& kind = kinds[k];
+        if (k)
+            json += ',';
+        json += "{\"domain\":";
+        append_json_string(json, kind.domain ? g_quark_to_string(kind.domain) : "");
+        json += ",\"code\":" + std::to_string(kind.code) + ",\"message\":";
+        append_json_string(json, kind.message);
+        json += ",\"count\":" + std::to_string(starts[k + 1] - starts[k]) + ",\"paths\":[";
+        for (std::size_t i = starts[k]; i < starts[k + 1]; ++i) {
+            if (i != starts[k])
+                json += ',';
+            append_json_string(json, path_of(sorted[i]));
+        }
+        json += "]}";
+    }
+    json += "]}\n";
+    out << json;
+}
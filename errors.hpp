@@ -0,0 +1,103 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ERRORS_HPP
+#define ERRORS_HPP
+
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <libsecret-1/libsecret/secret.h>
+
+
+/*
+ * Collects per-object failures, for --errors=summary and --errors=json.
+ *
+ * Each failure is stored as a (message id, object path) pair; identical messages are
+ * stored only once.
+ */
+class ErrorTable {
+public:
+
+    // Takes ownership of the error.
+    void
+    add(GError* error,
+        std::string_view path);
+
+
+    void
+    add(std::string_view message,
+        std::string_view path);
+
+
+    bool
+    empty()
+        const noexcept
+    {
+        return records.empty();
+    }
+
+
+    void
+    print_summary(std::ostream& out)
+        const;
+
+
+    void
+    print_json(std::ostream& out)
+        const;
+
+private:
+
+    struct Kind {
+        GQuark domain;
+        int code;
+        std::string message;
+    };
+
+
+    struct Record {
+        std::uint32_t kind;
+        std::uint32_t path_offset;
+        std::uint32_t path_size;
+    };
+
+
+    std::uint32_t
+    intern(GQuark domain,
+           int code,
+           std::string_view message);
+
+
+    // Records sorted by kind, and the index where each kind starts.
+    std::vector<Record>
+    grouped(std::vector<std::size_t>& starts)
+        const;
+
+
+    std::string_view
+    path_of(const Record& r)
+        const noexcept
+    {
+        return std::string_view{paths}.substr(r.path_offset, r.path_size);
+    }
+
+
+    std::deque<Kind> kinds; // stable, so kind_ids can point into it
+    std::unordered_map<std::string_view, std::uint32_t> kind_ids;
+    std::vector<Record> records;
+    std::string paths;
+
+};
+
+
+#endif
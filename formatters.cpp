@@ -0,0 +1,559 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <charconv>
+#include <ctime>
+#include <utility>
+
+#include "formatters.hpp"
+#include "utils.hpp"
+
+
+void
+append_field(std::string& out,
+             std::string_view field)
+{
+    for (char c : field) {
+        switch (c) {
+        case '\t':
+            out += "\\t";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default:
+            out += c;
+        }
+    }
+}
+
+
+void
+append_timestamp(std::string& out,
+                 std::uint64_t t)
+{
+    std::time_t tt = t;
+    std::tm tm;
+    char text[32];
+    if (!::localtime_r(&tt, &tm))
+        return;
+    out.append(text, std::strftime(text, sizeof text, "%F %T", &tm));
+}
+
+
+void
+append_number(std::string& out,
+              std::uint64_t n)
+{
+    char text[20];
+    auto [end, ec] = std::to_chars(text, text + sizeof text, n);
+    out.append(text, end);
+}
+
+
+TextFormatter::TextFormatter(std::ostream& out,
+                             BinaryEncoding binary) :
+    out{out},
+    binary{binary}
+{
+    buf.reserve(block_size + block_size / 4);
+}
+
+
+TextFormatter::~TextFormatter()
+{
+    // keep what was formatted before a failure
+    try {
+        flush();
+    }
+    catch (...) {}
+}
+
+
+void
+TextFormatter::begin_collection(std::string_view path,
+                                std::string_view label,
+                                std::uint64_t created,
+                                std::uint64_t modified)
+{
+    error_prefix = collection_error_prefix;
+
+    buf += "    Collection: \"";
+    buf += label;
+    buf += "\"\n      Path: ";
+    buf += path;
+    buf += '\n';
+
+    auto range = reverse_aliases.equal_range(path);
+    for (auto i = range.first; i != range.second; ++i) {
+        buf += "      Alias: ";
+        buf += i->second;
+        buf += '\n';
+    }
+
+    if (created) {
+        buf += "      Created: ";
+        append_timestamp(buf, created);
+        buf += '\n';
+    }
+    if (modified) {
+        buf += "      Modified: ";
+        append_timestamp(buf, modified);
+        buf += '\n';
+    }
+}
+
+
+void
+TextFormatter::begin_item(std::string_view path,
+                          std::string_view label,
+                          std::uint64_t created,
+                          std::uint64_t modified)
+{
+    error_prefix = item_error_prefix;
+    attributes_started = false;
+
+    buf += "        Item: \"";
+    buf += label;
+    buf += "\"\n          Path: ";
+    buf += path;
+    buf += '\n';
+
+    if (created) {
+        buf += "          Created: ";
+        append_timestamp(buf, created);
+        buf += '\n';
+    }
+    if (modified) {
+        buf += "          Modified: ";
+        append_timestamp(buf, modified);
+        buf += '\n';
+    }
+}
+
+
+void
+TextFormatter::secret(std::string_view type,
+                      bool is_text,
+                      std::string_view data)
+{
+    buf += "          Secret:\n            Type: ";
+    buf += type;
+    buf += '\n';
+
+    if (is_text) {
+        buf += "            Value: \"";
+        buf += data;
+        buf += "\"\n";
+    } else if (binary == BinaryEncoding::Raw) {
+        // the byte count makes the framing unambiguous
+        buf += "            Value: ";
+        append_number(buf, data.size());
+        buf += " bytes (raw)\n";
+        append_secret(data);
+        buf += '\n';
+    } else {
+        buf += "            Value: { ";
+        append_secret(data);
+        buf += " } (";
+        buf += to_string(binary);
+        buf += ")\n";
+    }
+}
+
+
+void
+TextFormatter::append_secret(std::string_view data)
+{
+    if (data.size() < stream_size) {
+        append_encoded(buf, data, binary);
+        return;
+    }
+    // stream it, instead of holding up to twice its size in the buffer
+    write_buffer();
+    write_encoded(out, data, binary);
+}
+
+
+void
+TextFormatter::error(std::string_view,
+                     std::string_view message)
+{
+    buf += error_prefix;
+    buf += message;
+    buf += '\n';
+}
+
+
+void
+TextFormatter::flush()
+{
+    write_buffer();
+    out.flush();
+}
+
+
+void
+TextFormatter::write_buffer()
+{
+    out.write(buf.data(), buf.size());
+    buf.clear();
+}
+
+
+GroupedFormatter::GroupedFormatter(std::ostream& out,
+                                   BinaryEncoding binary,
+                                   bool secret_column) :
+    TextFormatter{out, binary},
+    secret_column{secret_column}
+{}
+
+
+void
+GroupedFormatter::end_collection()
+{
+    for (std::size_t i = 0; i < groups.size(); ++i)
+        flush_group(i);
+    groups.clear();
+    group_index.clear();
+    TextFormatter::end_collection();
+}
+
+
+void
+GroupedFormatter::begin_item(std::string_view path,
+                             std::string_view label,
+                             std::uint64_t,
+                             std::uint64_t modified)
+{
+    in_item = true;
+    keys.clear();
+    values.clear();
+    secret_value.clear();
+    item_errors.clear();
+    item_is_locked = false;
+
+    // the item's id is the last component of its path
+    row.clear();
+    append_field(row, path.substr(path.rfind('/') + 1));
+    row += '\t';
+    append_field(row, label);
+    row += '\t';
+    if (modified)
+        append_timestamp(row, modified);
+}
+
+
+void
+GroupedFormatter::secret(std::string_view,
+                         bool is_text,
+                         std::string_view data)
+{
+    if (is_text)
+        append_field(secret_value, data);
+    else {
+        secret_value += "{ ";
+        append_encoded(secret_value, data, binary);
+        secret_value += " }";
+    }
+}
+
+
+void
+GroupedFormatter::end_item()
+{
+    in_item = false;
+
+    auto [it, inserted] = group_index.try_emplace(keys, groups.size());
+    if (inserted)
+        groups.push_back(Group{keys, 0, {}});
+    auto& group = groups[it->second];
+
+    group.lines += "          ";
+    group.lines += row;
+    group.lines += item_is_locked ? "\ttrue" : "\tfalse";
+    group.lines += values;
+    if (secret_column) {
+        group.lines += '\t';
+        group.lines += secret_value;
+    }
+    group.lines += '\n';
+    // keep the errors next to the item's row
+    group.lines += item_errors;
+
+    if (++group.num_rows >= max_rows)
+        flush_group(it->second);
+}
+
+
+void
+GroupedFormatter::error(std::string_view path,
+                        std::string_view message)
+{
+    if (!in_item) {
+        TextFormatter::error(path, message);
+        return;
+    }
+    item_errors += "        Error: ";
+    item_errors += path.substr(path.rfind('/') + 1);
+    item_errors += ": ";
+    item_errors += message;
+    item_errors += '\n';
+}
+
+
+void
+GroupedFormatter::flush_group(std::size_t index)
+{
+    auto& group = groups[index];
+    if (!group.num_rows)
+        return;
+
+    buf += "        Group: ";
+    append_number(buf, index + 1);
+    buf += "\n          id\tlabel\tmodified\tlocked";
+    for (auto& key : group.keys) {
+        buf += '\t';
+        append_field(buf, key);
+    }
+    if (secret_column)
+        buf += "\tsecret";
+    buf += '\n';
+
+    buf += group.lines;
+    group.lines.clear();
+    group.num_rows = 0;
+    maybe_flush();
+}
+
+
+JsonFormatter::JsonFormatter(std::ostream& out,
+                             BinaryEncoding binary) :
+    out{out},
+    binary{binary}
+{
+    buf.reserve(block_size + block_size / 4);
+}
+
+
+JsonFormatter::~JsonFormatter()
+{
+    try {
+        flush();
+    }
+    catch (...) {}
+}
+
+
+void
+JsonFormatter::service(std::string_view path)
+{
+    buf += "{\"service\":";
+    append_json_string(buf, path);
+}
+
+
+void
+JsonFormatter::alias(std::string_view alias,
+                     std::string_view path)
+{
+    buf += aliases_open ? "," : ",\"aliases\":{";
+    aliases_open = true;
+    append_json_string(buf, alias);
+    buf += ':';
+    append_json_string(buf, path);
+    reverse_aliases.emplace(path, alias);
+}
+
+
+void
+JsonFormatter::end_service()
+{
+    if (aliases_open)
+        buf += '}';
+}
+
+
+void
+JsonFormatter::begin_collection(std::string_view path,
+                                std::string_view label,
+                                std::uint64_t created,
+                                std::uint64_t modified)
+{
+    buf += collections_open ? ",\n" : ",\"collections\":[\n";
+    collections_open = true;
+    in_collection = true;
+
+    buf += "{\"path\":";
+    append_json_string(buf, path);
+    buf += ",\"label\":";
+    append_json_string(buf, label);
+
+    auto range = reverse_aliases.equal_range(path);
+    if (range.first != range.second) {
+        buf += ",\"aliases\":[";
+        for (auto i = range.first; i != range.second; ++i) {
+            if (i != range.first)
+                buf += ',';
+            append_json_string(buf, i->second);
+        }
+        buf += ']';
+    }
+
+    if (created) {
+        buf += ",\"created\":";
+        append_number(buf, created);
+    }
+    if (modified) {
+        buf += ",\"modified\":";
+        append_number(buf, modified);
+    }
+}
+
+
+void
+JsonFormatter::end_collection()
+{
+    if (items_open)
+        buf += ']';
+    buf += '}';
+    items_open = false;
+    in_collection = false;
+    maybe_flush();
+}
+
+
+void
+JsonFormatter::begin_item(std::string_view path,
+                          std::string_view label,
+                          std::uint64_t created,
+                          std::uint64_t modified)
+{
+    buf += items_open ? ",\n" : ",\"items\":[\n";
+    items_open = true;
+    in_item = true;
+
+    buf += "{\"path\":";
+    append_json_string(buf, path);
+    buf += ",\"label\":";
+    append_json_string(buf, label);
+    if (created) {
+        buf += ",\"created\":";
+        append_number(buf, created);
+    }
+    if (modified) {
+        buf += ",\"modified\":";
+        append_number(buf, modified);
+    }
+}
+
+
+void
+JsonFormatter::attribute(std::string_view key,
+                         std::string_view value)
+{
+    buf += attributes_open ? "," : ",\"attributes\":{";
+    attributes_open = true;
+    append_json_string(buf, key);
+    buf += ':';
+    append_json_string(buf, value);
+}
+
+
+void
+JsonFormatter::secret(std::string_view type,
+                      bool is_text,
+                      std::string_view data)
+{
+    close_attributes();
+    buf += ",\"secret\":{\"type\":";
+    append_json_string(buf, type);
+    if (is_text) {
+        buf += ",\"text\":";
+        append_json_string(buf, data);
+    } else {
+        buf += ",\"data\":\"";
+        if (data.size() < stream_size)
+            append_encoded(buf, data, binary);
+        else {
+            // stream it, instead of holding up to twice its size in the buffer
+            write_buffer();
+            write_encoded(out, data, binary);
+        }
+        buf += "\",\"encoding\":\"";
+        buf += to_string(binary);
+        buf += '"';
+    }
+    buf += '}';
+}
+
+
+void
+JsonFormatter::end_item()
+{
+    close_attributes();
+    buf += '}';
+    in_item = false;
+    maybe_flush();
+}
+
+
+void
+JsonFormatter::error(std::string_view path,
+                     std::string_view message)
+{
+    if (!in_item && !in_collection) {
+        std::string entry = "{\"path\":";
+        append_json_string(entry, path);
+        entry += ",\"message\":";
+        append_json_string(entry, message);
+        entry += '}';
+        other_errors.push_back(std::move(entry));
+        return;
+    }
+    close_attributes();
+    buf += ",\"error\":";
+    append_json_string(buf, message);
+}
+
+
+void
+JsonFormatter::flush()
+{
+    write_buffer();
+    out.flush();
+}
+
+
+void
+JsonFormatter::write_buffer()
+{
+    out.write(buf.data(), buf.size());
+    buf.clear();
+}
+
+
+void
+JsonFormatter::finish()
+{
+    if (collections_open)
+        buf += "\n]";
+    if (!other_errors.empty()) {
+        buf += ",\"errors\":[";
+        for (std::size_t i = 0; i < other_errors.size(); ++i) {
+            if (i)
+                buf += ',';
+            buf += other_errors[i];
+        }
+        buf += ']';
+    }
+    buf += "}\n";
+    flush();
+}
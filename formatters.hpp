@@ -0,0 +1,466 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef FORMATTERS_HPP
+#define FORMATTERS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "encoding.hpp"
+
+
+/*
+ * Output formats of the listing.
+ *
+ * The traversal in main.cpp is a template over the formatter, chosen once from --format,
+ * so every event below is a direct call; there's no common base class. A formatter gets
+ * these events, in this order:
+ *
+ *     service(path)
+ *     alias(alias, path)...
+ *     end_service()
+ *     begin_collection(path, label, created, modified)
+ *         collection_locked(locked)
+ *         begin_item(path, label, created, modified)
+ *             attribute(key, value)...
+ *             item_locked(locked)
+ *             secret(type, is_text, data)
+ *         end_item()
+ *     end_collection()
+ *     finish()
+ *
+ * Each part of an item is only sent at the detail level that shows it. An error(path,
+ * message) can come in place of a lock state or a secret, or between two collections.
+ *
+ * When item_rows is true, the lock state of every item is sent at any detail, and the
+ * secrets of locked items are not fetched.
+ */
+
+
+// Escapes tabs, newlines and backslashes, so a value fits in one column.
+void
+append_field(std::string& out,
+             std::string_view field);
+
+
+// Appends a timestamp as a local "YYYY-MM-DD HH:MM:SS".
+void
+append_timestamp(std::string& out,
+                 std::uint64_t t);
+
+
+void
+append_number(std::string& out,
+              std::uint64_t n);
+
+
+// The indented layout, one field per line.
+class TextFormatter {
+public:
+
+    static constexpr bool item_rows = false;
+
+    // the buffer is written out once it holds this many bytes
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    // secrets of this size or more are encoded straight to the output
+    static constexpr std::size_t stream_size = 16 * 1024;
+
+
+    TextFormatter(std::ostream& out,
+                  BinaryEncoding binary);
+
+
+    ~TextFormatter();
+
+
+    void
+    service(std::string_view path)
+    {
+        buf += "Service\n  Path: ";
+        buf += path;
+        buf += '\n';
+    }
+
+
+    void
+    alias(std::string_view alias,
+          std::string_view path)
+    {
+        if (reverse_aliases.empty())
+            buf += "  Aliases:\n";
+        buf += "    ";
+        buf += alias;
+        buf += ": ";
+        buf += path;
+        buf += '\n';
+        reverse_aliases.emplace(path, alias);
+    }
+
+
+    void
+    end_service()
+    {
+        buf += '\n';
+    }
+
+
+    void
+    begin_collection(std::string_view path,
+                     std::string_view label,
+                     std::uint64_t created,
+                     std::uint64_t modified);
+
+
+    void
+    collection_locked(bool locked)
+    {
+        buf += locked ? "      Locked: true\n\n" : "      Locked: false\n\n";
+    }
+
+
+    void
+    end_collection()
+    {
+        buf += '\n';
+        error_prefix = service_error_prefix;
+        maybe_flush();
+    }
+
+
+    void
+    begin_item(std::string_view path,
+               std::string_view label,
+               std::uint64_t created,
+               std::uint64_t modified);
+
+
+    void
+    attribute(std::string_view key,
+              std::string_view value)
+    {
+        if (!attributes_started) {
+            buf += "          Attributes:\n";
+            attributes_started = true;
+        }
+        buf += "              \"";
+        buf += key;
+        buf += "\" = \"";
+        buf += value;
+        buf += "\"\n";
+    }
+
+
+    void
+    item_locked(bool locked)
+    {
+        buf += locked ? "          Locked: true\n" : "          Locked: false\n";
+    }
+
+
+    void
+    secret(std::string_view type,
+           bool is_text,
+           std::string_view data);
+
+
+    void
+    end_item()
+    {
+        buf += '\n';
+        error_prefix = collection_error_prefix;
+        maybe_flush();
+    }
+
+
+    void
+    error(std::string_view path,
+          std::string_view message);
+
+
+    // Writes out what was formatted so far.
+    void
+    flush();
+
+
+    void
+    finish()
+    {
+        flush();
+    }
+
+protected:
+
+    static constexpr std::string_view service_error_prefix = "    Error: ";
+    static constexpr std::string_view collection_error_prefix = "      Error: ";
+    static constexpr std::string_view item_error_prefix = "          Error: ";
+
+    std::ostream& out;
+    BinaryEncoding binary;
+    std::string buf;
+    std::multimap<std::string, std::string, std::less<>> reverse_aliases;
+    std::string_view error_prefix = service_error_prefix;
+    bool attributes_started = false;
+
+
+    void
+    maybe_flush()
+    {
+        if (buf.size() >= block_size)
+            write_buffer();
+    }
+
+
+    void
+    write_buffer();
+
+
+    void
+    append_secret(std::string_view data);
+
+};
+
+
+/*
+ * The service and collections as in TextFormatter, and the items of each collection
+ * grouped by their set of attribute keys: the group's number and column names, then one
+ * tab-separated row per item. Rows are buffered per group, with the errors of their items,
+ * and a group is flushed when its buffer is full; each flush starts with the group's
+ * header again, so rows never end up under another group's columns.
+ */
+class GroupedFormatter : public TextFormatter {
+public:
+
+    static constexpr bool item_rows = true;
+
+    static constexpr std::size_t max_rows = 64;
+
+
+    GroupedFormatter(std::ostream& out,
+                     BinaryEncoding binary,
+                     bool secret_column);
+
+
+    // The item events hide the ones in TextFormatter.
+
+    void
+    end_collection();
+
+
+    void
+    begin_item(std::string_view path,
+               std::string_view label,
+               std::uint64_t created,
+               std::uint64_t modified);
+
+
+    void
+    attribute(std::string_view key,
+              std::string_view value)
+    {
+        keys.emplace_back(key);
+        values += '\t';
+        append_field(values, value);
+    }
+
+
+    void
+    item_locked(bool locked)
+    {
+        item_is_locked = locked;
+    }
+
+
+    void
+    secret(std::string_view type,
+           bool is_text,
+           std::string_view data);
+
+
+    void
+    end_item();
+
+
+    void
+    error(std::string_view path,
+          std::string_view message);
+
+private:
+
+    struct Group {
+        std::vector<std::string> keys;
+        std::size_t num_rows = 0;
+        std::string lines;
+    };
+
+    // numbered from 1, in the order they're first seen
+    std::vector<Group> groups;
+    std::map<std::vector<std::string>, std::size_t> group_index;
+    bool secret_column;
+
+    // the item being formatted
+    bool in_item = false;
+    std::string row;
+    std::vector<std::string> keys;
+    std::string values;
+    std::string secret_value;
+    std::string item_errors;
+    bool item_is_locked = false;
+
+
+    void
+    flush_group(std::size_t index);
+
+};
+
+
+/*
+ * A single JSON object, with one collection or item per line:
+ *
+ *     {"service":PATH,"aliases":{ALIAS:PATH,...},"collections":[
+ *     {"path":PATH,"label":LABEL,"aliases":[...],"created":T,"modified":T,"locked":B,"items":[
+ *     {"path":PATH,"label":LABEL,...,"attributes":{...},"locked":B,"secret":{...}},
+ *     ...]}],"errors":[...]}
+ *
+ * Errors on a collection or item are its "error" member; the others are listed at the end.
+ */
+class JsonFormatter {
+public:
+
+    static constexpr bool item_rows = false;
+
+    static constexpr std::size_t block_size = TextFormatter::block_size;
+
+    static constexpr std::size_t stream_size = TextFormatter::stream_size;
+
+
+    JsonFormatter(std::ostream& out,
+                  BinaryEncoding binary);
+
+
+    ~JsonFormatter();
+
+
+    void
+    service(std::string_view path);
+
+
+    void
+    alias(std::string_view alias,
+          std::string_view path);
+
+
+    void
+    end_service();
+
+
+    void
+    begin_collection(std::string_view path,
+                     std::string_view label,
+                     std::uint64_t created,
+                     std::uint64_t modified);
+
+
+    void
+    collection_locked(bool locked)
+    {
+        buf += locked ? ",\"locked\":true" : ",\"locked\":false";
+    }
+
+
+    void
+    end_collection();
+
+
+    void
+    begin_item(std::string_view path,
+               std::string_view label,
+               std::uint64_t created,
+               std::uint64_t modified);
+
+
+    void
+    attribute(std::string_view key,
+              std::string_view value);
+
+
+    void
+    item_locked(bool locked)
+    {
+        close_attributes();
+        buf += locked ? ",\"locked\":true" : ",\"locked\":false";
+    }
+
+
+    void
+    secret(std::string_view type,
+           bool is_text,
+           std::string_view data);
+
+
+    void
+    end_item();
+
+
+    void
+    error(std::string_view path,
+          std::string_view message);
+
+
+    void
+    flush();
+
+
+    void
+    finish();
+
+private:
+
+    std::ostream& out;
+    BinaryEncoding binary;
+    std::string buf;
+    std::multimap<std::string, std::string, std::less<>> reverse_aliases;
+    std::vector<std::string> other_errors;
+    bool aliases_open = false;
+    bool collections_open = false;
+    bool items_open = false;
+    bool attributes_open = false;
+    bool in_collection = false;
+    bool in_item = false;
+
+
+    void
+    close_attributes()
+    {
+        if (attributes_open) {
+            buf += '}';
+            attributes_open = false;
+        }
+    }
+
+
+    void
+    maybe_flush()
+    {
+        if (buf.size() >= block_size)
+            write_buffer();
+    }
+
+
+    void
+    write_buffer();
+
+};
+
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "generate.hpp"
+#include "pipeline.hpp"
+#include "utils.hpp"
+
+
+using namespace std::literals;
+
+
+namespace {
+
+
+    /*
+     * SplitMix64. The standard distributions are not specified exactly, so all draws
+     * are done here, to get the same keyring from the same seed everywhere.
+     */
+    class Random {
+        std::uint64_t state;
+
+    public:
+
+        explicit
+        Random(std::uint64_t seed)
+            noexcept :
+            state{seed}
+        {}
+
+
+        std::uint64_t
+        next()
+            noexcept
+        {
+            std::uint64_t z = (state += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+
+        // In [lo, hi].
+        std::uint64_t
+        range(std::uint64_t lo,
+              std::uint64_t hi)
+            noexcept
+        {
+            return lo + next() % (hi - lo + 1);
+        }
+
+
+        template<std::size_t N>
+        const char*
+        pick(const char* const (&choices)[N])
+            noexcept
+        {
+            return choices[next() % N];
+        }
+
+
+        // Log-uniform in [lo, hi], lo > 0: each doubling of lo is as likely, and sizes are
+        // uniform within it; the last one ends at hi.
+        std::size_t
+        size(std::size_t lo,
+             std::size_t hi)
+            noexcept
+        {
+            unsigned doublings = 1;
+            while ((lo << doublings) < hi)
+                ++doublings;
+            unsigned k = range(0, doublings - 1);
+            std::size_t first = lo << k;
+            std::size_t last = k + 1 == doublings ? hi : (lo << (k + 1)) - 1;
+            return range(first, last);
+        }
+    };
+
+
+    const char* const users[] = {
+        "alice", "bob", "carol", "dave", "erin", "frank", "grace", "heidi",
+        "ivan", "judy", "mallory", "oscar", "peggy", "trent", "victor", "walter"
+    };
+
+    const char* const hosts[] = {
+        "mail", "files", "git", "wiki", "vpn", "build", "db", "intranet",
+        "print", "backup", "chat", "calendar"
+    };
+
+    const char* const domains[] = {
+        "example.com", "example.org", "example.net", "corp.example.com"
+    };
+
+    const char* const sites[] = {
+        "shop", "news", "forum", "bank", "mail", "video", "social", "cloud",
+        "travel", "docs", "photos", "games"
+    };
+
+    const char* const protocols[] = {"smb", "ftp", "sftp", "http", "https", "imap"};
+
+    const char* const key_types[] = {"id_ed25519", "id_rsa", "id_ecdsa", "deploy_key"};
+
+    const char* const blob_types[] = {
+        "application/pkix-cert",
+        "application/x-keytab",
+        "application/octet-stream"
+    };
+
+
+    struct Spec {
+        std::string label;
+        std::map<std::string, std::string> attributes;
+        std::string content_type;
+        std::string secret;
+    };
+
+
+    std::string
+    password(Random& rng,
+             std::size_t len)
+    {
+        static const char chars[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789!#$%&*+-.:;=?@_";
+        std::string result(len, ' ');
+        for (auto& c : result)
+            c = chars[rng.next() % (sizeof chars - 1)];
+        return result;
+    }
+
+
+    /*
+     * Each item has its own generator, so the spec doesn't depend on creation order. The
+     * operands of one expression are evaluated in no fixed order, so every draw is its own
+     * statement; otherwise compilers could build different keyrings from the same seed.
+     */
+    Spec
+    make_spec(std::uint64_t seed,
+              std::size_t index)
+    {
+        Random rng{seed ^ (0x6a09e667f3bcc909 * (index + 1))};
+        Spec spec;
+        std::string user = rng.pick(users);
+
+        auto kind = rng.range(0, 99);
+        if (kind < 40) {
+            std::string host_name = rng.pick(hosts);
+            std::string host = host_name + "." + rng.pick(domains);
+            std::string protocol = rng.pick(protocols);
+            spec.label = user + "@" + host;
+            spec.attributes = {
+                {"xdg:schema", "org.gnome.keyring.NetworkPassword"},
+                {"user", user},
+                {"server", host},
+                {"protocol", protocol},
+                {"port", std::to_string(rng.range(1, 4) == 1 ? rng.range(1024, 65535) : 0)}
+            };
+            if (rng.range(0, 2) == 0)
+                spec.attributes["domain"] = "CORP";
+            spec.content_type = "text/plain";
+            spec.secret = password(rng, rng.range(8, 24));
+        } else if (kind < 85) {
+            std::string site = rng.pick(sites);
+            std::string site_number = std::to_string(rng.range(1, 500));
+            std::string domain = rng.pick(domains);
+            std::string origin = "https://" + site + site_number + "." + domain + "/";
+            spec.label = origin;
+            spec.attributes = {
+                {"xdg:schema", "chrome_libsecret_password_schema"},
+                {"application", rng.range(0, 3) ? "chrome" : "chromium"},
+                {"origin_url", origin},
+                {"action_url", origin + "login"},
+                {"signon_realm", origin},
+                {"username_element", "username"},
+                {"username_value", user + "@" + rng.pick(domains)},
+                {"password_element", "password"},
+                {"submit_element", ""},
+                {"date_created", std::to_string(13'300'000'000'000'000 + rng.next() % 10'000'000'000'000)},
+                {"times_used", std::to_string(rng.range(0, 300))},
+                {"scheme", "0"},
+                {"preferred", "1"},
+                {"blacklisted_by_user", "0"}
+            };
+            spec.content_type = "text/plain";
+            spec.secret = password(rng, rng.range(10, 32));
+        } else if (kind < 95) {
+            std::string key = "/home/"s + user + "/.ssh/" + rng.pick(key_types);
+            spec.label = "Unlock password for: " + user + "@" + rng.pick(hosts);
+            spec.attributes = {
+                {"xdg:schema", "org.freedesktop.Secret.Generic"},
+                {"unique", "ssh-store:" + key}
+            };
+            spec.content_type = "text/plain";
+            spec.secret = password(rng, rng.range(12, 40));
+        } else {
+            std::string type = rng.pick(blob_types);
+            spec.label = user + " " + (type == "application/x-keytab" ? "keytab" : "certificate");
+            spec.attributes = {
+                {"xdg:schema", "org.freedesktop.Secret.Generic"},
+                {"owner", user},
+                {"purpose", type}
+            };
+            spec.content_type = type;
+            spec.secret.resize(rng.size(512, 16384));
+            for (auto& c : spec.secret)
+                c = rng.next();
+        }
+
+        return spec;
+    }
+
+
+    using ValuePtr = std::shared_ptr<SecretValue>;
+
+
+} // namespace
+
+
+void
+generate_keyring(const GenerateOptions& options,
+                 std::ostream& out)
+{
+    if (options.bus.empty())
+        throw std::runtime_error{"--generate requires --to-bus, to never fill the"
+                                 " session keyring by mistake."};
+
+    GError* error = nullptr;
+    auto service = take(secret_service_open_sync(SECRET_TYPE_SERVICE,
+                                                 options.bus.c_str(),
+                                                 SecretServiceFlags(SECRET_SERVICE_OPEN_SESSION
+                                                                    | SECRET_SERVICE_LOAD_COLLECTIONS),
+                                                 nullptr,
+                                                 &error));
+    if (error)
+        throw_error(error);
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Collections are few, create them before pipelining the items.
+    std::vector<GObjectWrapper<SecretCollection>> collections;
+    std::size_t created_collections = 0;
+    if (!options.collections) {
+        auto col = take(secret_collection_for_alias_sync(service,
+                                                         "default",
+                                                         SECRET_COLLECTION_NONE,
+                                                         nullptr,
+                                                         &error));
+        if (error)
+            throw_error(error);
+        if (!col.get())
+            throw std::runtime_error{"The service has no default collection."};
+        collections.push_back(std::move(col));
+    } else {
+        std::map<std::string, GObjectWrapper<SecretCollection>> existing;
+        for (auto& col : to_vector<SecretCollection>(secret_service_get_collections(service)))
+            existing.emplace(to_string(secret_collection_get_label(col)).value_or(""), col);
+
+        for (std::size_t i = 0; i < options.collections; ++i) {
+            std::string label = "Generated " + std::to_string(i + 1);
+            if (auto found = existing.find(label); found != existing.end()) {
+                collections.push_back(found->second);
+                continue;
+            }
+            auto col = take(secret_collection_create_sync(service,
+                                                          label.c_str(),
+                                                          nullptr,
+                                                          SECRET_COLLECTION_CREATE_NONE,
+                                                          nullptr,
+                                                          &error));
+            if (error)
+                throw std::runtime_error{"Couldn't create collection \"" + label + "\": "
+                                         + to_error(error).what()};
+            collections.push_back(std::move(col));
+            ++created_collections;
+        }
+    }
+
+    Pipeline pipeline{options.jobs};
+    for (std::size_t i = 0; i < options.items; ++i) {
+        auto spec = std::make_shared<Spec>(make_spec(options.seed, i));
+        auto col = collections[Random{options.seed + i}.next() % collections.size()];
+        pipeline.add("Create \"" + spec->label + "\"",
+                     [col, spec](GAsyncReadyCallback cb, gpointer data) mutable
+                     {
+                         ValuePtr value{secret_value_new(spec->secret.data(),
+                                                         spec->secret.size(),
+                                                         spec->content_type.c_str()),
+                                        secret_value_unref};
+                         GHashTable* table = to_hash_table(spec->attributes);
+                         secret_item_create(col,
+                                            nullptr,
+                                            table,
+                                            spec->label.c_str(),
+                                            value.get(),
+                                            SECRET_ITEM_CREATE_NONE,
+                                            nullptr,
+                                            cb,
+                                            data);
+                         g_hash_table_unref(table);
+                     },
+                     [](GObject*, GAsyncResult* result, GError** error)
+                     {
+                         auto item = take(secret_item_create_finish(result, error));
+                         return item.get() != nullptr;
+                     });
+    }
+    pipeline.run();
+
+    for (auto& msg : pipeline.get_errors())
+        out << "Error: " << msg << '\n';
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::size_t created = options.items - pipeline.get_errors().size();
+    out << "Created collections: " << created_collections << '\n'
+        << "Created items: " << created << '\n'
+        << "Time: " << elapsed.count() << " s";
+    if (elapsed.count() > 0)
+        out << " (" << static_cast<std::size_t>(created / elapsed.count()) << " items/s)";
+    out << '\n';
+}
@@ -0,0 +1,38 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GENERATE_HPP
+#define GENERATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+
+struct GenerateOptions {
+    std::string bus;              // D-Bus name of the target service
+    std::uint64_t seed = 1;
+    std::size_t collections = 4;  // 0 puts every item in the default collection
+    std::size_t items = 1000;     // in total, spread over the collections
+    std::size_t jobs = 32;        // max calls in flight
+};
+
+
+/*
+ * Fills a service with synthetic collections and items, for benchmarks.
+ *
+ * The same seed always produces the same labels, attributes and secrets. Items follow
+ * the schemas of network passwords, browser logins, SSH key passphrases and binary
+ * blobs such as certificates and keytabs.
+ */
+void
+generate_keyring(const GenerateOptions& options,
+                 std::ostream& out);
+
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.hpp"
+
+
+namespace {
+
+
+    struct HistoryHeader {
+        char magic[8];
+        std::uint32_t record_size;
+        std::uint32_t capacity;
+        std::uint64_t written; // total records ever appended
+    };
+
+    constexpr char history_magic[8] = {'L', 'S', 'S', 'H', 'I', 'S', 'T', '1'};
+
+
+    const char* const phase_names[HistoryRecord::NumPhases] = {
+        "connect",
+        "aliases",
+        "listing",
+        "unlock",
+        "secrets",
+        "total"
+    };
+
+
+    // Closes the file, releasing its lock.
+    class LockedFile {
+        int fd;
+
+    public:
+
+        LockedFile(const std::string& filename,
+                   int flags,
+                   int lock)
+        {
+            fd = ::open(filename.c_str(), flags | O_CLOEXEC, 0600);
+            if (fd == -1)
+                throw std::system_error{errno, std::generic_category(), filename};
+            if (::flock(fd, lock) == -1) {
+                int e = errno;
+                ::close(fd);
+                throw std::system_error{e, std::generic_category(), filename};
+            }
+        }
+
+
+        LockedFile(const LockedFile&) = delete;
+
+
+        ~LockedFile()
+        {
+            ::close(fd);
+        }
+
+
+        bool
+        read_at(void* buf,
+                std::size_t len,
+                off_t offset)
+        {
+            return ::pread(fd, buf, len, offset) == static_cast<ssize_t>(len);
+        }
+
+
+        void
+        write_at(const void* buf,
+                 std::size_t len,
+                 off_t offset)
+        {
+            if (::pwrite(fd, buf, len, offset) != static_cast<ssize_t>(len))
+                throw std::system_error{errno, std::generic_category(), "pwrite()"};
+        }
+    };
+
+
+    bool
+    valid(const HistoryHeader& h)
+        noexcept
+    {
+        return !std::memcmp(h.magic, history_magic, sizeof h.magic)
+            && h.record_size == sizeof(HistoryRecord)
+            && h.capacity > 0;
+    }
+
+
+    off_t
+    record_offset(const HistoryHeader& h,
+                  std::uint64_t index)
+        noexcept
+    {
+        return sizeof h + (index % h.capacity) * sizeof(HistoryRecord);
+    }
+
+
+    template<typename T>
+    T
+    median(std::vector<T> v)
+    {
+        if (v.empty())
+            return {};
+        auto mid = v.begin() + v.size() / 2;
+        std::nth_element(v.begin(), mid, v.end());
+        return *mid;
+    }
+
+
+    double
+    ms(std::uint64_t us)
+        noexcept
+    {
+        return us / 1000.0;
+    }
+
+
+    std::string
+    format_time(std::uint64_t t)
+    {
+        std::time_t tt = t;
+        std::tm tm;
+        ::localtime_r(&tt, &tm);
+        char buf[32];
+        std::strftime(buf, sizeof buf, "%F %T", &tm);
+        return buf;
+    }
+
+
+} // namespace
+
+
+void
+append_history(const std::string& filename,
+               const HistoryRecord& record)
+{
+    LockedFile file{filename, O_RDWR | O_CREAT, LOCK_EX};
+
+    HistoryHeader header;
+    if (!file.read_at(&header, sizeof header, 0) || !valid(header)) {
+        std::memcpy(header.magic, history_magic, sizeof header.magic);
+        header.record_size = sizeof(HistoryRecord);
+        header.capacity = history_capacity;
+        header.written = 0;
+    }
+
+    file.write_at(&record, sizeof record, record_offset(header, header.written));
+    ++header.written;
+    file.write_at(&header, sizeof header, 0);
+}
+
+
+std::vector<HistoryRecord>
+read_history(const std::string& filename)
+{
+    struct stat st;
+    if (::stat(filename.c_str(), &st) == -1 && errno == ENOENT)
+        return {};
+
+    LockedFile file{filename, O_RDONLY, LOCK_SH};
+
+    HistoryHeader header;
+    if (!file.read_at(&header, sizeof header, 0) || !valid(header))
+        throw std::runtime_error{"\"" + filename + "\" is not a history file."};
+
+    std::uint64_t count = std::min<std::uint64_t>(header.written, header.capacity);
+    std::vector<HistoryRecord> records(count);
+    for (std::uint64_t i = 0; i < count; ++i) {
+        std::uint64_t index = header.written - count + i;
+        if (!file.read_at(&records[i], sizeof(HistoryRecord), record_offset(header, index)))
+            throw std::runtime_error{"\"" + filename + "\" is truncated."};
+    }
+    return records;
+}
+
+
+void
+report_history(const std::vector<HistoryRecord>& records,
+               std::size_t n,
+               std::ostream& out)
+{
+    if (records.empty()) {
+        out << "No runs recorded.\n";
+        return;
+    }
+
+    n = std::min(n, records.size());
+    auto first = records.end() - n;
+
+    auto old_flags = out.flags();
+    auto old_precision = out.precision(1);
+    out << std::fixed;
+
+    out << "Last " << n << " of " << records.size() << " recorded runs:\n";
+    for (auto r = first; r != records.end(); ++r) {
+        std::string version{r->version, strnlen(r->version, sizeof r->version)};
+        out << "  "
+            << format_time(r->timestamp)
+            << "  v" << version
+            << "  -d" << r->detail
+            << std::setw(8) << r->items << " items"
+            << std::setw(10) << ms(r->phase_us[HistoryRecord::Total]) << " ms"
+            << std::setw(7) << r->round_trips << " calls"
+            << std::setw(9) << r->peak_rss_kib << " KiB\n";
+    }
+
+    out << "Medians:\n";
+    for (unsigned p = 0; p < HistoryRecord::NumPhases; ++p) {
+        std::vector<std::uint64_t> v;
+        for (auto r = first; r != records.end(); ++r)
+            v.push_back(r->phase_us[p]);
+        out << "  " << std::left << std::setw(9) << phase_names[p] << std::right
+            << std::setw(10) << ms(median(v)) << " ms\n";
+    }
+
+    // Compare the latest run against the ones before it.
+    if (n < 2) {
+        out.flags(old_flags);
+        out.precision(old_precision);
+        return;
+    }
+    auto& latest = records.back();
+    std::vector<std::uint64_t> totals, items, rss;
+    for (auto r = first; r != records.end() - 1; ++r) {
+        totals.push_back(r->phase_us[HistoryRecord::Total]);
+        items.push_back(r->items);
+        rss.push_back(r->peak_rss_kib);
+    }
+
+    bool found = false;
+    auto check = [&](const char* what, double now, double before, double limit)
+    {
+        if (before > 0 && now > before * limit) {
+            if (!found)
+                out << "Regressions in the latest run:\n";
+            found = true;
+            out << "  " << what << ": " << now << " vs median " << before
+                << " (" << now / before << "x)\n";
+        }
+    };
+    check("run time (ms)", ms(latest.phase_us[HistoryRecord::Total]), ms(median(totals)), 1.5);
+    check("items", latest.items, median(items), 1.2);
+    check("peak RSS (KiB)", latest.peak_rss_kib, median(rss), 1.5);
+    if (!found)
+        out << "No regressions in the latest run.\n";
+
+    out.flags(old_flags);
+    out.precision(old_precision);
+}
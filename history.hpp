@@ -0,0 +1,80 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/*
+ * One run of lssecrets, as stored in the history file. The file is a ring buffer of
+ * these fixed-size records, so it never grows past `history_capacity` records.
+ */
+struct HistoryRecord {
+
+    enum Phase : unsigned {
+        Connect,
+        Aliases,
+        Listing,
+        Unlock,
+        Secrets,
+        Total,
+        NumPhases
+    };
+
+
+    enum Option : std::uint32_t {
+        OptUnlock     = 1 << 0,
+        OptBulk       = 1 << 1,
+        OptGrouped    = 1 << 2,
+        OptErrors     = 1 << 3,
+        OptOutputFile = 1 << 4,
+        OptSlowest    = 1 << 5,
+    };
+
+
+    std::uint64_t timestamp = 0; // seconds since the epoch
+    char version[16] = {};
+    std::uint32_t options = 0;
+    std::int32_t detail = 0;
+    std::uint32_t collections = 0;
+    std::uint32_t items = 0;
+    std::uint32_t round_trips = 0; // D-Bus method calls sent, counted on the bus
+    std::uint32_t reserved = 0;
+    std::uint64_t peak_rss_kib = 0;
+    std::uint64_t phase_us[NumPhases] = {};
+
+};
+
+
+constexpr std::uint32_t history_capacity = 1024;
+
+
+// Appends the record, overwriting the oldest one when the file is full.
+void
+append_history(const std::string& filename,
+               const HistoryRecord& record);
+
+
+// Returns the stored records, oldest first; none if the file doesn't exist yet.
+std::vector<HistoryRecord>
+read_history(const std::string& filename);
+
+
+// Prints the last `n` runs, their medians, and the latest run's regressions.
+void
+report_history(const std::vector<HistoryRecord>& records,
+               std::size_t n,
+               std::ostream& out);
+
+
+#endif
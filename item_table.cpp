@@ -0,0 +1,270 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_AVX2_INTRINSICS 1
+#include <immintrin.h>
+#endif
+
+#include "item_table.hpp"
+
+
+namespace {
+
+
+    std::uint32_t
+    append(std::string& arena,
+           std::string_view s)
+    {
+        std::size_t offset = arena.size();
+        if (offset + s.size() + 1 > UINT32_MAX)
+            throw std::length_error{"Item table is too large."};
+        arena += s;
+        arena += '\0';
+        return offset;
+    }
+
+
+    std::size_t
+    words(std::size_t rows)
+        noexcept
+    {
+        return (rows + 63) / 64;
+    }
+
+
+    std::string
+    term(std::string_view key,
+         std::string_view value)
+    {
+        std::string result{key};
+        result += '\0';
+        result += value;
+        return result;
+    }
+
+
+    // Computes one selection word at a time from a per-row predicate.
+    template<typename Pred>
+    void
+    filter_scalar(ItemTable::Selection& sel,
+                  std::size_t first_row,
+                  std::size_t rows,
+                  Pred pred)
+        noexcept
+    {
+        for (std::size_t w = first_row / 64; w < words(rows); ++w) {
+            std::uint64_t bits = 0;
+            std::size_t end = std::min(rows, (w + 1) * 64);
+            for (std::size_t row = w * 64; row < end; ++row)
+                bits |= std::uint64_t{pred(row)} << (row % 64);
+            sel[w] &= bits;
+        }
+    }
+
+
+#ifdef HAVE_AVX2_INTRINSICS
+
+
+    // Returns the number of rows done, a multiple of 64.
+    __attribute__((target("avx2")))
+    std::size_t
+    filter_since_avx2(ItemTable::Selection& sel,
+                      const std::uint64_t* modified,
+                      std::size_t rows,
+                      std::uint64_t since)
+        noexcept
+    {
+        // timestamps fit in 63 bits, so the signed compare works
+        const __m256i limit = _mm256_set1_epi64x(since - 1);
+        std::size_t w = 0;
+        for (; (w + 1) * 64 <= rows; ++w) {
+            std::uint64_t bits = 0;
+            const std::uint64_t* p = modified + w * 64;
+            for (unsigned i = 0; i < 16; ++i) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 4 * i));
+                __m256i gt = _mm256_cmpgt_epi64(v, limit);
+                std::uint64_t mask = _mm256_movemask_pd(_mm256_castsi256_pd(gt));
+                bits |= mask << (4 * i);
+            }
+            sel[w] &= bits;
+        }
+        return w * 64;
+    }
+
+
+    bool
+    have_avx2()
+        noexcept
+    {
+        static const bool result = __builtin_cpu_supports("avx2");
+        return result;
+    }
+
+
+#endif // HAVE_AVX2_INTRINSICS
+
+
+} // namespace
+
+
+std::uint32_t
+ItemTable::add_collection(std::string path)
+{
+    std::uint32_t row = size();
+    collections.push_back(Collection{std::move(path), row, row});
+    return collections.size() - 1;
+}
+
+
+void
+ItemTable::add_item(std::string_view path,
+                    std::string_view label,
+                    std::uint64_t item_created,
+                    std::uint64_t item_modified,
+                    bool locked,
+                    const std::map<std::string, std::string>* attributes)
+{
+    if (collections.empty())
+        throw std::logic_error{"ItemTable::add_item() called before add_collection()."};
+
+    std::uint32_t row = size();
+    if (row == UINT32_MAX)
+        throw std::length_error{"Item table is too large."};
+
+    created.push_back(item_created);
+    modified.push_back(item_modified);
+    if (row % 64 == 0)
+        locked_bits.push_back(0);
+    locked_bits.back() |= std::uint64_t{locked} << (row % 64);
+    path_offset.push_back(append(arena, path));
+    label_offset.push_back(append(arena, label));
+    collections.back().end_row = row + 1;
+
+    if (attributes)
+        for (auto& [key, val] : *attributes)
+            postings[term(key, val)].push_back(row);
+}
+
+
+void
+ItemTable::finish()
+{
+    // the arena doesn't move anymore, so it can be viewed
+    rows_by_path.clear();
+    rows_by_path.reserve(size());
+    for (std::uint32_t row = 0; row < size(); ++row)
+        rows_by_path.emplace(path(row), row);
+}
+
+
+std::string_view
+ItemTable::path(std::uint32_t row)
+    const noexcept
+{
+    return arena.data() + path_offset[row];
+}
+
+
+std::string_view
+ItemTable::label(std::uint32_t row)
+    const noexcept
+{
+    return arena.data() + label_offset[row];
+}
+
+
+std::optional<std::uint32_t>
+ItemTable::find(std::string_view item_path)
+    const
+{
+    auto found = rows_by_path.find(item_path);
+    if (found == rows_by_path.end())
+        return {};
+    return found->second;
+}
+
+
+ItemTable::Selection
+ItemTable::select_all()
+    const
+{
+    Selection sel(words(size()), ~std::uint64_t{0});
+    // clear the bits past the last row
+    if (size() % 64)
+        sel.back() = (std::uint64_t{1} << (size() % 64)) - 1;
+    return sel;
+}
+
+
+bool
+ItemTable::any_selected(const Selection& sel,
+                        std::uint32_t first_row,
+                        std::uint32_t end_row)
+    const noexcept
+{
+    for (std::uint32_t row = first_row; row < end_row; ) {
+        if (row % 64 == 0 && row + 64 <= end_row) {
+            if (sel[row / 64])
+                return true;
+            row += 64;
+        } else {
+            if (is_selected(sel, row))
+                return true;
+            ++row;
+        }
+    }
+    return false;
+}
+
+
+void
+ItemTable::filter_modified_since(Selection& sel,
+                                 std::uint64_t since)
+    const noexcept
+{
+    if (!since)
+        return;
+    std::size_t done = 0;
+#ifdef HAVE_AVX2_INTRINSICS
+    if (have_avx2())
+        done = filter_since_avx2(sel, modified.data(), size(), since);
+#endif
+    filter_scalar(sel, done, size(),
+                  [this, since](std::size_t row)
+                  {
+                      return modified[row] >= since;
+                  });
+}
+
+
+void
+ItemTable::filter_locked(Selection& sel,
+                         bool locked)
+    const noexcept
+{
+    for (std::size_t w = 0; w < sel.size(); ++w)
+        sel[w] &= locked ? locked_bits[w] : ~locked_bits[w];
+}
+
+
+void
+ItemTable::filter_attribute(Selection& sel,
+                            std::string_view key,
+                            std::string_view value)
+    const
+{
+    Selection matches(sel.size(), 0);
+    auto found = postings.find(term(key, value));
+    if (found != postings.end())
+        for (auto row : found->second)
+            matches[row / 64] |= std::uint64_t{1} << (row % 64);
+    for (std::size_t w = 0; w < sel.size(); ++w)
+        sel[w] &= matches[w];
+}
@@ -0,0 +1,152 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ITEM_TABLE_HPP
+#define ITEM_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+/*
+ * Column-oriented table of items, for filtering a whole keyring at once.
+ *
+ * Each column is a contiguous array indexed by row; labels and paths are offsets into
+ * one string arena. The items of a collection must be added together, so each
+ * collection is a range of rows. Filters narrow a Selection, a bitmap with one bit per
+ * row, and scan whole columns (with AVX2 where available).
+ */
+class ItemTable {
+public:
+
+    using Selection = std::vector<std::uint64_t>;
+
+
+    struct Collection {
+        std::string path;
+        std::uint32_t first_row;
+        std::uint32_t end_row;
+    };
+
+
+    std::uint32_t
+    add_collection(std::string path);
+
+
+    // Adds a row to the last collection; attributes are only indexed if given.
+    void
+    add_item(std::string_view path,
+             std::string_view label,
+             std::uint64_t created,
+             std::uint64_t modified,
+             bool locked,
+             const std::map<std::string, std::string>* attributes = nullptr);
+
+
+    // Builds the path index; call after the last add_item().
+    void
+    finish();
+
+
+    std::size_t
+    size()
+        const noexcept
+    {
+        return modified.size();
+    }
+
+
+    std::string_view
+    path(std::uint32_t row)
+        const noexcept;
+
+
+    std::string_view
+    label(std::uint32_t row)
+        const noexcept;
+
+
+    std::optional<std::uint32_t>
+    find(std::string_view path)
+        const;
+
+
+    const Collection&
+    get_collection(std::uint32_t index)
+        const
+    {
+        return collections.at(index);
+    }
+
+
+    Selection
+    select_all()
+        const;
+
+
+    static
+    bool
+    is_selected(const Selection& sel,
+                std::uint32_t row)
+        noexcept
+    {
+        return sel[row / 64] >> (row % 64) & 1;
+    }
+
+
+    bool
+    any_selected(const Selection& sel,
+                 std::uint32_t first_row,
+                 std::uint32_t end_row)
+        const noexcept;
+
+
+    void
+    filter_modified_since(Selection& sel,
+                          std::uint64_t since)
+        const noexcept;
+
+
+    void
+    filter_locked(Selection& sel,
+                  bool locked)
+        const noexcept;
+
+
+    void
+    filter_attribute(Selection& sel,
+                     std::string_view key,
+                     std::string_view value)
+        const;
+
+private:
+
+    // columns
+    std::vector<std::uint64_t> created;
+    std::vector<std::uint64_t> modified;
+    std::vector<std::uint64_t> locked_bits;
+    std::vector<std::uint32_t> path_offset;
+    std::vector<std::uint32_t> label_offset;
+
+    std::string arena; // NUL-terminated strings
+    std::vector<Collection> collections;
+
+    // "key\0value" -> ascending rows
+    std::unordered_map<std::string, std::vector<std::uint32_t>> postings;
+
+    std::unordered_map<std::string_view, std::uint32_t> rows_by_path;
+
+};
+
+
+#endif
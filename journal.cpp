@@ -0,0 +1,194 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "journal.hpp"
+
+
+namespace {
+
+
+    const char journal_socket[] = "/run/systemd/journal/socket";
+
+
+    sockaddr_un
+    journal_address()
+        noexcept
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, journal_socket, sizeof addr.sun_path - 1);
+        return addr;
+    }
+
+
+} // namespace
+
+
+void
+JournalSink::Entry::add(std::string_view name,
+                        std::string_view value)
+{
+    data += name;
+    if (value.find('\n') == std::string_view::npos) {
+        data += '=';
+        data += value;
+    } else {
+        // binary-safe form: name, newline, 64-bit little-endian size, value
+        data += '\n';
+        std::uint64_t size = value.size();
+        for (int i = 0; i < 8; ++i)
+            data += static_cast<char>(size >> (8 * i));
+        data += value;
+    }
+    data += '\n';
+}
+
+
+void
+JournalSink::Entry::add_normalized(std::string_view prefix,
+                                   std::string_view name,
+                                   std::string_view value)
+{
+    // Field names are limited to 64 characters from [A-Z0-9_].
+    std::string field{prefix};
+    for (char c : name) {
+        if (field.size() >= 64)
+            break;
+        if (c >= 'a' && c <= 'z')
+            field += c - 'a' + 'A';
+        else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+            field += c;
+        else
+            field += '_';
+    }
+    add(field, value);
+}
+
+
+JournalSink::JournalSink()
+{
+    fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw std::system_error{errno, std::generic_category(), "socket()"};
+
+    auto addr = journal_address();
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) == -1) {
+        int e = errno;
+        ::close(fd);
+        throw std::system_error{e, std::generic_category(), journal_socket};
+    }
+
+    pending.reserve(batch_size);
+}
+
+
+JournalSink::~JournalSink()
+{
+    try {
+        flush();
+    }
+    catch (...) {}
+    ::close(fd);
+}
+
+
+void
+JournalSink::submit(Entry&& entry)
+{
+    pending.push_back(std::move(entry));
+    if (pending.size() >= batch_size)
+        flush();
+}
+
+
+void
+JournalSink::flush()
+{
+    std::size_t done = 0;
+    while (done < pending.size()) {
+        iovec iov[batch_size];
+        mmsghdr msgs[batch_size] = {};
+        std::size_t n = std::min(pending.size() - done, batch_size);
+        for (std::size_t i = 0; i < n; ++i) {
+            auto& data = pending[done + i].data;
+            iov[i].iov_base = data.data();
+            iov[i].iov_len = data.size();
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = ::sendmmsg(fd, msgs, n, 0);
+        if (sent > 0) {
+            done += sent;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EMSGSIZE) {
+            // too big for a datagram: journald also accepts the entry in a sealed memfd
+            send_memfd(pending[done].data);
+            ++done;
+            continue;
+        }
+        int e = errno;
+        pending.clear();
+        throw std::system_error{e, std::generic_category(), "sendmmsg()"};
+    }
+    pending.clear();
+}
+
+
+void
+JournalSink::send_memfd(const std::string& data)
+{
+    int mfd = ::memfd_create("lssecrets-journal", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (mfd == -1)
+        throw std::system_error{errno, std::generic_category(), "memfd_create()"};
+
+    std::size_t written = 0;
+    while (written < data.size()) {
+        auto r = ::write(mfd, data.data() + written, data.size() - written);
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            int e = errno;
+            ::close(mfd);
+            throw std::system_error{e, std::generic_category(), "write()"};
+        }
+        written += r;
+    }
+    ::fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &mfd, sizeof(int));
+
+    auto r = ::sendmsg(fd, &msg, 0);
+    int e = errno;
+    ::close(mfd);
+    if (r == -1)
+        throw std::system_error{e, std::generic_category(), "sendmsg()"};
+}
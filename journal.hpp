@@ -0,0 +1,76 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/*
+ * Writes structured entries to the systemd journal through its native protocol, sending
+ * up to `batch_size` entries per sendmmsg() call.
+ */
+class JournalSink {
+public:
+
+    class Entry {
+        std::string data;
+
+        friend class JournalSink;
+
+    public:
+
+        // `name` must be a valid journal field name.
+        void
+        add(std::string_view name,
+            std::string_view value);
+
+
+        // Prefixes `name` and turns it into a valid field name.
+        void
+        add_normalized(std::string_view prefix,
+                       std::string_view name,
+                       std::string_view value);
+    };
+
+
+    static constexpr std::size_t batch_size = 64;
+
+
+    JournalSink();
+
+
+    JournalSink(const JournalSink&) = delete;
+
+
+    ~JournalSink();
+
+
+    void
+    submit(Entry&& entry);
+
+
+    void
+    flush();
+
+private:
+
+    void
+    send_memfd(const std::string& data);
+
+
+    int fd = -1;
+    std::vector<Entry> pending;
+
+};
+
+
+#endif
@@ -5,14 +5,28 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iomanip>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -23,12 +37,36 @@
 #include <glibmm/datetime.h>
 #include <glibmm/error.h>
 #include <glibmm/main.h>
+#include <glibmm/miscutils.h>
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
+#include "alias_cache.hpp"
+#include "bulk_secrets.hpp"
+#include "digest.hpp"
+#include "encoding.hpp"
+#include "errors.hpp"
+#include "formatters.hpp"
+#include "generate.hpp"
+#include "history.hpp"
+#include "item_table.hpp"
+#include "journal.hpp"
+#include "output_file.hpp"
+#include "pipeline.hpp"
+#include "snapshot.hpp"
+#include "split_ring.hpp"
+#include "sync.hpp"
+#include "utils.hpp"
+
 
 using std::cout;
 using std::clog;
@@ -41,265 +79,486 @@ using namespace std::literals;
 #if HAVE_GLIBMM_2_68
 #define AF_NON_UNIQUE Gio::Application::Flags::NON_UNIQUE
 #define OEF_IN_MAIN   Glib::OptionEntry::Flags::IN_MAIN
+#define OEF_HIDDEN    Glib::OptionEntry::Flags::HIDDEN
 #else
 #define AF_NON_UNIQUE Gio::ApplicationFlags::APPLICATION_NON_UNIQUE
 #define OEF_IN_MAIN   Glib::OptionEntry::Flags::FLAG_IN_MAIN
+#define OEF_HIDDEN    Glib::OptionEntry::Flags::FLAG_HIDDEN
 #endif
 
 
-template<typename T>
-class GObjectWrapper {
-    T* ptr = nullptr;
+extern char** environ;
+
+
+// Parses seconds since the epoch, or a local "YYYY-MM-DD[ HH:MM:SS]".
+std::uint64_t
+parse_time(const std::string& text)
+{
+    if (!text.empty() && std::all_of(text.begin(), text.end(),
+                                     [](unsigned char c) { return std::isdigit(c); }))
+        return std::stoull(text);
+
+    for (const char* format : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%d"}) {
+        std::tm tm{};
+        std::istringstream in{text};
+        in >> std::get_time(&tm, format);
+        if (!in || in.peek() != std::char_traits<char>::eof())
+            continue;
+        tm.tm_isdst = -1;
+        std::time_t t = std::mktime(&tm);
+        if (t != -1)
+            return t;
+    }
+    throw std::runtime_error{"Invalid time: \"" + text + "\""};
+}
 
+
+// Accumulates time and bytes spent on each object, for the --slowest report.
+class CostTable {
 public:
 
-    GObjectWrapper() noexcept = default;
+    using clock = std::chrono::steady_clock;
 
 
-    explicit
-    GObjectWrapper(T* p, bool add_ref = false)
-        noexcept :
-        ptr{p}
+    enum Op : unsigned {
+        Load,
+        Unlock,
+        Secret,
+        NumOps
+    };
+
+
+    struct Entry {
+        const char* kind;
+        std::string path;
+        clock::duration time[NumOps] = {};
+        std::size_t bytes = 0;
+
+
+        clock::duration
+        total()
+            const noexcept
+        {
+            clock::duration result{};
+            for (auto t : time)
+                result += t;
+            return result;
+        }
+    };
+
+
+    class Timer {
+        CostTable* table;
+        std::size_t idx;
+        Op op;
+        clock::time_point start;
+
+    public:
+
+        Timer(CostTable* t, std::size_t i, Op o)
+            noexcept :
+            table{t},
+            idx{i},
+            op{o}
+        {
+            if (table)
+                start = clock::now();
+        }
+
+
+        Timer(const Timer&) = delete;
+
+
+        ~Timer()
+        {
+            if (table)
+                table->add_time(idx, op, clock::now() - start);
+        }
+    };
+
+
+    bool enabled = false;
+
+
+    // Returns the slot index for this object, the same one every time; only meaningful
+    // when enabled.
+    std::size_t
+    add(const char* kind,
+        const char* path)
     {
-        if (add_ref)
-            ref();
+        if (!enabled)
+            return 0;
+        auto [it, inserted] = slots.try_emplace(path, entries.size());
+        if (inserted)
+            entries.push_back(Entry{kind, path});
+        return it->second;
     }
 
 
-    GObjectWrapper(const GObjectWrapper& other)
-        noexcept :
-        ptr{other.ptr}
+    Timer
+    time(std::size_t idx,
+         Op op)
+        noexcept
     {
-        ref();
+        return Timer{enabled ? this : nullptr, idx, op};
     }
 
 
-    GObjectWrapper(GObjectWrapper&& other)
-        noexcept :
-        ptr{other.ptr}
+    void
+    add_time(std::size_t idx,
+             Op op,
+             clock::duration d)
+        noexcept
     {
-        other.ptr = nullptr;
+        if (enabled)
+            entries[idx].time[op] += d;
     }
 
 
-    GObjectWrapper&
-    operator =(const GObjectWrapper& other)
+    void
+    add_bytes(std::size_t idx,
+              std::size_t n)
         noexcept
     {
-        unref();
-        ptr = other.ptr;
-        ref();
-        return *this;
+        if (enabled)
+            entries[idx].bytes += n;
     }
 
 
-    GObjectWrapper&
-    operator =(GObjectWrapper&& other)
+    void
+    report(std::ostream& out,
+           std::size_t n)
+    {
+        n = std::min(n, entries.size());
+        if (!n)
+            return;
+
+        std::vector<const Entry*> order;
+        order.reserve(entries.size());
+        for (auto& e : entries)
+            order.push_back(&e);
+
+        auto ms = [](clock::duration d) -> double
+        {
+            return std::chrono::duration<double, std::milli>(d).count();
+        };
+
+        auto print_entry = [&out, &ms](const Entry& e)
+        {
+            out << "    "
+                << std::setw(10) << ms(e.total()) << " ms "
+                << std::setw(12) << e.bytes << " B  "
+                << std::left << std::setw(10) << e.kind << std::right
+                << e.path
+                << "  (load " << ms(e.time[Load])
+                << ", unlock " << ms(e.time[Unlock])
+                << ", secret " << ms(e.time[Secret])
+                << ")\n";
+        };
+
+        auto old_flags = out.flags();
+        auto old_precision = out.precision(3);
+        out << std::fixed;
+
+        std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                          [](const Entry* a, const Entry* b)
+                          {
+                              return a->total() > b->total();
+                          });
+        out << "Slowest objects:\n";
+        for (std::size_t i = 0; i < n; ++i)
+            print_entry(*order[i]);
+        out << '\n';
+
+        std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                          [](const Entry* a, const Entry* b)
+                          {
+                              return a->bytes > b->bytes;
+                          });
+        out << "Largest objects:\n";
+        for (std::size_t i = 0; i < n; ++i)
+            print_entry(*order[i]);
+
+        out.flags(old_flags);
+        out.precision(old_precision);
+    }
+
+private:
+
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, std::size_t> slots; // by path
+
+};
+
+
+/*
+ * Adds the time spent in a scope to one phase of the run's history record. A phase timed
+ * inside another one is taken out of the outer one, so the phases add up to the total.
+ */
+class PhaseTimer {
+    std::uint64_t& us;
+    CostTable::clock::time_point start;
+    PhaseTimer* outer;
+
+    static inline PhaseTimer* current = nullptr;
+
+
+    void
+    add_until(CostTable::clock::time_point end)
         noexcept
     {
-        unref();
-        ptr = other.ptr;
-        other.ptr = nullptr;
-        return *this;
+        us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
     }
 
+public:
 
-    ~GObjectWrapper()
+    explicit
+    PhaseTimer(std::uint64_t& us)
+        noexcept :
+        us{us},
+        start{CostTable::clock::now()},
+        outer{current}
     {
-        unref();
+        if (outer)
+            outer->add_until(start);
+        current = this;
     }
 
 
-    void
-    ref()
+    PhaseTimer(const PhaseTimer&) = delete;
+
+
+    ~PhaseTimer()
     {
-        if (ptr)
-            g_object_ref(ptr);
+        auto end = CostTable::clock::now();
+        add_until(end);
+        current = outer;
+        if (outer)
+            outer->start = end;
     }
+};
 
 
-    void
-    unref()
+/*
+ * Counts the method calls sent on the session bus, which libsecret shares. A single
+ * libsecret call can send many of them, e.g. one GetAll per proxy it loads.
+ */
+class CallCounter {
+    GObjectWrapper<GDBusConnection> connection;
+    guint filter_id;
+    std::atomic<std::uint32_t> calls = 0;
+
+
+    // Runs in the GDBus worker thread.
+    static
+    GDBusMessage*
+    filter(GDBusConnection*,
+           GDBusMessage* message,
+           gboolean incoming,
+           gpointer data)
     {
-        if (ptr)
-            g_object_unref(ptr);
+        if (!incoming
+            && g_dbus_message_get_message_type(message) == G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+            ++static_cast<CallCounter*>(data)->calls;
+        return message;
     }
 
+public:
 
-    T*
-    get()
-        noexcept
+    CallCounter()
     {
-        return ptr;
+        GError* error = nullptr;
+        connection = take(g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error));
+        if (error)
+            throw_error(error);
+        filter_id = g_dbus_connection_add_filter(connection, filter, this, nullptr);
     }
 
 
-    operator T* ()
-        noexcept
+    CallCounter(const CallCounter&) = delete;
+
+
+    ~CallCounter()
     {
-        return get();
+        g_dbus_connection_remove_filter(connection, filter_id);
     }
 
 
-    operator GDBusProxy* ()
-        noexcept
+    std::uint32_t
+    get()
+        const noexcept
     {
-        return G_DBUS_PROXY(get());
+        return calls;
     }
+};
 
 
+// Records sent from the --split fetcher to the formatter.
+enum SplitRecord : std::uint32_t {
+    RecService,    // path
+    RecAlias,      // alias, path
+    RecCollection, // path, label, created, modified
+    RecItem,       // path, label, created, modified
+    RecAttribute,  // key, value
+    RecLocked,     // locked
+    RecSecret,     // content type, is text, data
+    RecError,      // path, message
+    RecDone,       // end of the service, the current collection or item
+    RecEnd,        // method calls made
+    RecFatal       // message
 };
 
 
 template<typename T>
-GObjectWrapper<T>
-take(T* obj)
+std::string_view
+as_field(const T& value)
+    noexcept
 {
-    return GObjectWrapper<T>{obj, false};
+    return {reinterpret_cast<const char*>(&value), sizeof value};
 }
 
 
 template<typename T>
-GObjectWrapper<T>
-borrow(T* obj)
+T
+from_field(std::string_view field)
+    noexcept
 {
-    return GObjectWrapper<T>{obj, true};
+    T value{};
+    std::memcpy(&value, field.data(), std::min(field.size(), sizeof value));
+    return value;
 }
 
 
-template<typename T>
-std::vector<GObjectWrapper<T>>
-to_vector(GList* list)
-{
-    std::vector<GObjectWrapper<T>> result;
+// Writes the listing to the --split ring, for print_split() to pass to the formatter.
+class RingFormatter {
+    SharedRing& ring;
+    std::string item_path;
 
-    try {
-        for (GList* n = list; n; n = n->next) {
-            T* ptr = reinterpret_cast<T*>(n->data);
-            n->data = nullptr;
-            result.push_back(take(ptr));
-        }
-        g_list_free(list);
-    }
-    catch (...) {
-        g_list_free_full(list, g_object_unref);
-        throw;
-    }
+public:
 
-    return result;
-}
+    static constexpr bool item_rows = false;
 
 
-std::optional<std::string>
-to_string(gchar* s)
-{
-    if (!s)
-        return {};
+    explicit
+    RingFormatter(SharedRing& ring)
+        noexcept :
+        ring{ring}
+    {}
 
-    std::string result = s;
-    g_free(s);
-    return result;
-}
 
+    void
+    service(std::string_view path)
+    {
+        ring.write(RecService, {path});
+    }
 
-std::optional<std::string>
-to_string(const gchar* s)
-{
-    if (!s)
-        return {};
 
-    std::string result = s;
-    return result;
-}
+    void
+    alias(std::string_view alias,
+          std::string_view path)
+    {
+        ring.write(RecAlias, {alias, path});
+    }
 
 
-std::string
-to_string(const gchar* ptr, gsize len)
-{
-    std::ostringstream out;
-    out << std::setbase(16)
-        << std::setfill('0');
+    void
+    end_service()
+    {
+        ring.write(RecDone, {});
+    }
 
-    for (gsize i = 0; i < len; ++i)
-        out << std::setw(2)
-            << static_cast<unsigned char>(ptr[i]);
 
-    return out.str();
-}
+    void
+    begin_collection(std::string_view path,
+                     std::string_view label,
+                     guint64 created,
+                     guint64 modified)
+    {
+        ring.write(RecCollection, {path, label, as_field(created), as_field(modified)});
+    }
 
 
-std::optional<std::string>
-timestamp_to_string(guint64 t)
-{
-    auto dt = Glib::DateTime::create_now_local(t);
-    return dt.format("%F %T").raw();
-}
+    void
+    collection_locked(bool locked)
+    {
+        ring.write(RecLocked, {as_field(locked)});
+    }
 
 
-std::map<std::string, std::string>
-to_map(GHashTable* table)
-{
-    try {
-        std::map<std::string, std::string> result;
+    void
+    end_collection()
+    {
+        ring.write(RecDone, {});
+    }
 
-        GHashTableIter iter;
-        gpointer key, val;
-        g_hash_table_iter_init(&iter, table);
-        while (g_hash_table_iter_next(&iter, &key, &val)) {
-            std::string key_s = reinterpret_cast<const char*>(key);
-            std::string val_s = reinterpret_cast<const char*>(val);
-            result[key_s] = val_s;
-        }
-        g_hash_table_unref(table);
 
-        return result;
-    }
-    catch (...) {
-        g_hash_table_unref(table);
-        throw;
+    void
+    begin_item(std::string_view path,
+               std::string_view label,
+               guint64 created,
+               guint64 modified)
+    {
+        item_path = path;
+        ring.write(RecItem, {path, label, as_field(created), as_field(modified)});
     }
-}
 
 
+    void
+    attribute(std::string_view key,
+              std::string_view value)
+    {
+        ring.write(RecAttribute, {key, value});
+    }
 
-std::runtime_error
-to_error(GError* raw_err)
-{
-    Glib::Error err{raw_err}; // will free raw_err on destructor
 
-    std::string msg;
+    void
+    item_locked(bool locked)
+    {
+        ring.write(RecLocked, {as_field(locked)});
+    }
 
-    if (err.domain() != SECRET_ERROR) {
-        msg = "Couldn't get secret service.";
-    } else {
-        switch (err.code()) {
-        case SECRET_ERROR_PROTOCOL:
-            msg = "Received invalid data from secret service.";
-            break;
-        case SECRET_ERROR_IS_LOCKED:
-            msg = "Secret item or collection is locked.";
-            break;
-        case SECRET_ERROR_NO_SUCH_OBJECT:
-            msg = "Secret item or collection not found.";
-            break;
-        case SECRET_ERROR_ALREADY_EXISTS:
-            msg = "Secret item or collection already exists.";
-            break;
+
+    void
+    secret(std::string_view type,
+           bool is_text,
+           std::string_view data)
+    {
+        // only this item fails, not the whole listing
+        if (!ring.fits({type, as_field(is_text), data})) {
+            error(item_path,
+                  "The secret (" + std::to_string(data.size()) + " bytes) is too large"
+                  " for --split.");
+            return;
         }
+        ring.write(RecSecret, {type, as_field(is_text), data});
     }
 
-    msg += " "s + err.what();
 
-    return std::runtime_error{msg};
-}
+    void
+    end_item()
+    {
+        ring.write(RecDone, {});
+    }
 
 
-[[noreturn]]
-void
-throw_error(GError* raw_err)
-{
-    throw to_error(raw_err);
-}
+    void
+    error(std::string_view path,
+          std::string_view message)
+    {
+        ring.write(RecError, {path, message});
+    }
+
+
+    void
+    flush()
+    {}
+
+
+    void
+    finish()
+    {}
+
+};
 
 
 struct App : Gio::Application {
@@ -317,14 +576,126 @@ struct App : Gio::Application {
     int detail = Detail::Items;
     bool unlock_flag = false;
     bool version_flag = false;
+    int slowest = 0;
+    std::string merge_dir;
+    std::string out_file;
+    std::string index_file;
+    Glib::ustring query;
+    Glib::ustring format_name = "text";
+    bool sync_flag = false;
+    Glib::ustring from_bus;
+    Glib::ustring to_bus;
+    bool dry_run_flag = false;
+    int jobs = 32;
+    bool digest_flag = false;
+    std::string digest_cache;
+    std::string digest_key;
+    std::vector<std::string> digest_compare;
+    bool bulk_flag = false;
+    Glib::ustring errors_name = "inline";
+
+    enum class ErrorMode {
+        Inline,
+        Summary,
+        Json
+    };
+    ErrorMode error_mode = ErrorMode::Inline;
+    Glib::ustring output_name = "stdout";
+    std::string output_file;
+    bool direct_io_flag = false;
+    bool record_history_flag = false;
+    int history_runs = 0;
+    bool split_flag = false;
+    Glib::ustring binary_name = "hex";
+    bool cache_aliases_flag = false;
+    Glib::ustring collection_name;
+    bool generate_flag = false;
+    int seed = 1;
+    int num_collections = 4;
+    int num_items = 1000;
+    bool plan_flag = false;
+    Glib::ustring modified_since;
+    bool locked_only_flag = false;
+    Glib::ustring where;
+    std::vector<Glib::ustring> item_paths;
+    BinaryEncoding binary = BinaryEncoding::Hex;
+    int split_fd = -1;
+
+    enum class Format {
+        Text,
+        Grouped,
+        Json
+    };
+    Format format = Format::Text;
 
     Glib::OptionGroup main_group{"", ""};
     Glib::OptionEntry detail_opt;
     Glib::OptionEntry unlock_opt;
     Glib::OptionEntry version_opt;
+    Glib::OptionEntry slowest_opt;
+    Glib::OptionEntry merge_opt;
+    Glib::OptionEntry out_opt;
+    Glib::OptionEntry index_opt;
+    Glib::OptionEntry query_opt;
+    Glib::OptionEntry format_opt;
+    Glib::OptionEntry sync_opt;
+    Glib::OptionEntry from_bus_opt;
+    Glib::OptionEntry to_bus_opt;
+    Glib::OptionEntry dry_run_opt;
+    Glib::OptionEntry jobs_opt;
+    Glib::OptionEntry digest_opt;
+    Glib::OptionEntry digest_cache_opt;
+    Glib::OptionEntry digest_key_opt;
+    Glib::OptionEntry digest_compare_opt;
+    Glib::OptionEntry bulk_opt;
+    Glib::OptionEntry errors_opt;
+    Glib::OptionEntry output_opt;
+    Glib::OptionEntry output_file_opt;
+    Glib::OptionEntry direct_io_opt;
+    Glib::OptionEntry record_history_opt;
+    Glib::OptionEntry history_opt;
+    Glib::OptionEntry split_opt;
+    Glib::OptionEntry binary_opt;
+    Glib::OptionEntry cache_aliases_opt;
+    Glib::OptionEntry collection_opt;
+    Glib::OptionEntry generate_opt;
+    Glib::OptionEntry seed_opt;
+    Glib::OptionEntry collections_opt;
+    Glib::OptionEntry items_opt;
+    Glib::OptionEntry plan_opt;
+    Glib::OptionEntry modified_since_opt;
+    Glib::OptionEntry locked_only_opt;
+    Glib::OptionEntry where_opt;
+    Glib::OptionEntry item_opt;
+    Glib::OptionEntry split_fetcher_opt;
 
     std::optional<GObjectWrapper<SecretService>> service;
 
+    std::optional<BulkSecretFetcher> bulk;
+    std::unordered_map<std::string, BulkSecret> prefetched;
+
+    // item proxies loaded by get_items(), by collection path
+    std::unordered_map<std::string, std::vector<GObjectWrapper<SecretItem>>> loaded_items;
+
+    // while --plan lists the unlocked collections, with the unlock call pending
+    bool unlock_pending = false;
+
+    // only built when the items are filtered
+    std::optional<ItemTable> table;
+    ItemTable::Selection selection;
+
+    // reused for every item
+    std::vector<std::pair<std::string_view, std::string_view>> attribute_entries;
+
+    ErrorTable errors;
+
+    CostTable costs;
+
+    HistoryRecord stats;
+    bool listed = false; // so there's a run to record
+
+    int exit_status = EXIT_SUCCESS;
+
 
     App() :
         Gio::Application{"lssecrets.dkosmari.github.com", AF_NON_UNIQUE}
@@ -357,6 +728,248 @@ struct App : Gio::Application {
         version_opt.set_description("Print version number and exit.");
         main_group.add_entry(version_opt, version_flag);
 
+        slowest_opt.set_flags(OEF_IN_MAIN);
+        slowest_opt.set_long_name("slowest");
+        slowest_opt.set_description("Report the N objects that took the most time and bytes.");
+        slowest_opt.set_arg_description("N");
+        main_group.add_entry(slowest_opt, slowest);
+
+        merge_opt.set_flags(OEF_IN_MAIN);
+        merge_opt.set_long_name("merge-snapshots");
+        merge_opt.set_description("Merge the per-host --detail=3 dumps in DIR into an index"
+                                  " (requires --out).");
+        merge_opt.set_arg_description("DIR");
+        main_group.add_entry_filename(merge_opt, merge_dir);
+
+        out_opt.set_flags(OEF_IN_MAIN);
+        out_opt.set_long_name("out");
+        out_opt.set_description("Index file written by --merge-snapshots.");
+        out_opt.set_arg_description("FILE");
+        main_group.add_entry_filename(out_opt, out_file);
+
+        index_opt.set_flags(OEF_IN_MAIN);
+        index_opt.set_long_name("index");
+        index_opt.set_description("Index file searched by --query.");
+        index_opt.set_arg_description("FILE");
+        main_group.add_entry_filename(index_opt, index_file);
+
+        query_opt.set_flags(OEF_IN_MAIN);
+        query_opt.set_long_name("query");
+        query_opt.set_description("List the hosts and items that have this attribute"
+                                  " (requires --index).");
+        query_opt.set_arg_description("KEY=VALUE");
+        main_group.add_entry(query_opt, query);
+
+        format_opt.set_flags(OEF_IN_MAIN);
+        format_opt.set_long_name("format");
+        format_opt.set_short_name('f');
+        format_opt.set_description("Output format, where FORMAT is:\n"
+                                   "                                  text (default)\n"
+                                   "                                  grouped = one row per item,"
+                                   " grouped by attribute keys\n"
+                                   "                                  json");
+        format_opt.set_arg_description("FORMAT");
+        main_group.add_entry(format_opt, format_name);
+
+        sync_opt.set_flags(OEF_IN_MAIN);
+        sync_opt.set_long_name("sync");
+        sync_opt.set_description("Make the items of the --to-bus service match the"
+                                 " --from-bus service.");
+        main_group.add_entry(sync_opt, sync_flag);
+
+        from_bus_opt.set_flags(OEF_IN_MAIN);
+        from_bus_opt.set_long_name("from-bus");
+        from_bus_opt.set_description("D-Bus name of the source service for --sync.");
+        from_bus_opt.set_arg_description("NAME");
+        main_group.add_entry(from_bus_opt, from_bus);
+
+        to_bus_opt.set_flags(OEF_IN_MAIN);
+        to_bus_opt.set_long_name("to-bus");
+        to_bus_opt.set_description("D-Bus name of the target service for --sync.");
+        to_bus_opt.set_arg_description("NAME");
+        main_group.add_entry(to_bus_opt, to_bus);
+
+        dry_run_opt.set_flags(OEF_IN_MAIN);
+        dry_run_opt.set_long_name("dry-run");
+        dry_run_opt.set_description("Only print what --sync would change.");
+        main_group.add_entry(dry_run_opt, dry_run_flag);
+
+        jobs_opt.set_flags(OEF_IN_MAIN);
+        jobs_opt.set_long_name("jobs");
+        jobs_opt.set_short_name('j');
+        jobs_opt.set_description("Maximum number of calls in flight (default 32).");
+        jobs_opt.set_arg_description("N");
+        main_group.add_entry(jobs_opt, jobs);
+
+        digest_opt.set_flags(OEF_IN_MAIN);
+        digest_opt.set_long_name("digest");
+        digest_opt.set_description("Print a Merkle digest of every collection and item.");
+        main_group.add_entry(digest_opt, digest_flag);
+
+        digest_cache_opt.set_flags(OEF_IN_MAIN);
+        digest_cache_opt.set_long_name("digest-cache");
+        digest_cache_opt.set_description("Reuse the secret digests of unmodified items from"
+                                         " FILE, and update it.");
+        digest_cache_opt.set_arg_description("FILE");
+        main_group.add_entry_filename(digest_cache_opt, digest_cache);
+
+        digest_key_opt.set_flags(OEF_IN_MAIN);
+        digest_key_opt.set_long_name("digest-key");
+        digest_key_opt.set_description("Key the secret digests with the content of FILE,"
+                                       " instead of ~/.local/share/lssecrets/digest-key.");
+        digest_key_opt.set_arg_description("FILE");
+        main_group.add_entry_filename(digest_key_opt, digest_key);
+
+        digest_compare_opt.set_flags(OEF_IN_MAIN);
+        digest_compare_opt.set_long_name("digest-compare");
+        digest_compare_opt.set_description("Compare two digest files (give this option twice).");
+        digest_compare_opt.set_arg_description("FILE");
+        main_group.add_entry_filename(digest_compare_opt, digest_compare);
+
+        bulk_opt.set_flags(OEF_IN_MAIN);
+        bulk_opt.set_long_name("bulk-secrets");
+        bulk_opt.set_description("Fetch each collection's secrets in one call, and decrypt"
+                                 " them in parallel.");
+        main_group.add_entry(bulk_opt, bulk_flag);
+
+        errors_opt.set_flags(OEF_IN_MAIN);
+        errors_opt.set_long_name("errors");
+        errors_opt.set_description("How errors are reported, where MODE is:\n"
+                                   "                                  inline (default)\n"
+                                   "                                  summary = grouped, at the end, on stderr\n"
+                                   "                                  json = grouped, at the end, on stderr, as JSON");
+        errors_opt.set_arg_description("MODE");
+        main_group.add_entry(errors_opt, errors_name);
+
+        output_opt.set_flags(OEF_IN_MAIN);
+        output_opt.set_long_name("output");
+        output_opt.set_short_name('o');
+        output_opt.set_description("Where the listing goes, where DEST is:\n"
+                                   "                                  stdout (default)\n"
+                                   "                                  journal = one structured entry"
+                                   " per collection and item (never secrets)");
+        output_opt.set_arg_description("DEST");
+        main_group.add_entry(output_opt, output_name);
+
+        output_file_opt.set_flags(OEF_IN_MAIN);
+        output_file_opt.set_long_name("output-file");
+        output_file_opt.set_description("Write the output to FILE, replacing it atomically"
+                                        " when done.");
+        output_file_opt.set_arg_description("FILE");
+        main_group.add_entry_filename(output_file_opt, output_file);
+
+        direct_io_opt.set_flags(OEF_IN_MAIN);
+        direct_io_opt.set_long_name("direct-io");
+        direct_io_opt.set_description("Write --output-file with O_DIRECT, bypassing the"
+                                      " page cache.");
+        main_group.add_entry(direct_io_opt, direct_io_flag);
+
+        record_history_opt.set_flags(OEF_IN_MAIN);
+        record_history_opt.set_long_name("record-history");
+        record_history_opt.set_description("Append this run's timings to the history file.");
+        main_group.add_entry(record_history_opt, record_history_flag);
+
+        history_opt.set_flags(OEF_IN_MAIN);
+        history_opt.set_long_name("history");
+        history_opt.set_description("Report trends and regressions over the last N recorded"
+                                    " runs.");
+        history_opt.set_arg_description("N");
+        main_group.add_entry(history_opt, history_runs);
+
+        split_opt.set_flags(OEF_IN_MAIN);
+        split_opt.set_long_name("split");
+        split_opt.set_description("Fetch in a child process, and format in this one.");
+        main_group.add_entry(split_opt, split_flag);
+
+        binary_opt.set_flags(OEF_IN_MAIN);
+        binary_opt.set_long_name("binary");
+        binary_opt.set_description("How non-text secrets are printed, where ENCODING is:\n"
+                                   "                                  hex (default)\n"
+                                   "                                  base64\n"
+                                   "                                  base64url\n"
+                                   "                                  raw = the byte count, then"
+                                   " the bytes");
+        binary_opt.set_arg_description("ENCODING");
+        main_group.add_entry(binary_opt, binary_name);
+
+        cache_aliases_opt.set_flags(OEF_IN_MAIN);
+        cache_aliases_opt.set_long_name("cache-aliases");
+        cache_aliases_opt.set_description("Reuse the aliases resolved on earlier runs, while the"
+                                          " collections are the same.");
+        main_group.add_entry(cache_aliases_opt, cache_aliases_flag);
+
+        collection_opt.set_flags(OEF_IN_MAIN);
+        collection_opt.set_long_name("collection");
+        collection_opt.set_short_name('c');
+        collection_opt.set_description("Only list the collection with this alias or label.");
+        collection_opt.set_arg_description("NAME");
+        main_group.add_entry(collection_opt, collection_name);
+
+        generate_opt.set_flags(OEF_IN_MAIN);
+        generate_opt.set_long_name("generate");
+        generate_opt.set_description("Fill the --to-bus service with synthetic items, for"
+                                     " benchmarks.");
+        main_group.add_entry(generate_opt, generate_flag);
+
+        seed_opt.set_flags(OEF_IN_MAIN);
+        seed_opt.set_long_name("seed");
+        seed_opt.set_description("Seed for --generate (default 1).");
+        seed_opt.set_arg_description("N");
+        main_group.add_entry(seed_opt, seed);
+
+        collections_opt.set_flags(OEF_IN_MAIN);
+        collections_opt.set_long_name("collections");
+        collections_opt.set_description("Collections created by --generate (default 4; 0 uses"
+                                        " the default collection).");
+        collections_opt.set_arg_description("N");
+        main_group.add_entry(collections_opt, num_collections);
+
+        items_opt.set_flags(OEF_IN_MAIN);
+        items_opt.set_long_name("items");
+        items_opt.set_description("Items created by --generate (default 1000).");
+        items_opt.set_arg_description("N");
+        main_group.add_entry(items_opt, num_items);
+
+        plan_opt.set_flags(OEF_IN_MAIN);
+        plan_opt.set_long_name("plan");
+        plan_opt.set_description("List unlocked collections first, while the locked ones are"
+                                 " unlocked in one batch.");
+        main_group.add_entry(plan_opt, plan_flag);
+
+        modified_since_opt.set_flags(OEF_IN_MAIN);
+        modified_since_opt.set_long_name("modified-since");
+        modified_since_opt.set_description("Only list items modified at or after TIME"
+                                           " (\"YYYY-MM-DD[ HH:MM:SS]\" or seconds since"
+                                           " the epoch).");
+        modified_since_opt.set_arg_description("TIME");
+        main_group.add_entry(modified_since_opt, modified_since);
+
+        locked_only_opt.set_flags(OEF_IN_MAIN);
+        locked_only_opt.set_long_name("locked-only");
+        locked_only_opt.set_description("Only list items that are locked.");
+        main_group.add_entry(locked_only_opt, locked_only_flag);
+
+        where_opt.set_flags(OEF_IN_MAIN);
+        where_opt.set_long_name("where");
+        where_opt.set_description("Only list items that have this attribute.");
+        where_opt.set_arg_description("KEY=VALUE");
+        main_group.add_entry(where_opt, where);
+
+        item_opt.set_flags(OEF_IN_MAIN);
+        item_opt.set_long_name("item");
+        item_opt.set_short_name('i');
+        item_opt.set_description("Only list the item with this object path, without loading"
+                                 " the collections (can be repeated; \"-\" reads one path"
+                                 " per line from stdin).");
+        item_opt.set_arg_description("PATH");
+        main_group.add_entry(item_opt, item_paths);
+
+        // used by --split to start the fetcher
+        split_fetcher_opt.set_flags(OEF_HIDDEN);
+        split_fetcher_opt.set_long_name("split-fetcher");
+        split_fetcher_opt.set_arg_description("FD");
+        main_group.add_entry(split_fetcher_opt, split_fd);
+
         add_option_group(main_group);
     }
 
@@ -370,247 +983,1377 @@ struct App : Gio::Application {
             return;
         }
 
+        costs.enabled = slowest > 0;
+
+        if (split_fd >= 0) {
+            split_fetch();
+            return;
+        }
+
         try {
-            print();
+            if (output_file.empty()) {
+                dispatch();
+                return;
+            }
+
+            OutputFile file{output_file, direct_io_flag};
+            auto old_buf = cout.rdbuf(&file);
+            bool ok;
+            try {
+                dispatch();
+                ok = bool(cout.flush());
+            }
+            catch (...) {
+                cout.rdbuf(old_buf);
+                throw;
+            }
+            cout.rdbuf(old_buf);
+            if (!ok) {
+                std::string reason = file.get_error();
+                throw std::runtime_error{"Couldn't write \"" + output_file + "\""
+                                         + (reason.empty() ? "." : ": " + reason)};
+            }
+            file.commit();
         }
         catch (std::exception& e) {
             cerr << "Error: " << e.what() << endl;
+            exit_status = EXIT_FAILURE;
             quit();
+            return;
+        }
+
+        // only once the output is in place; the listing itself succeeded either way
+        if (listed && record_history_flag) {
+            try {
+                record_history();
+            }
+            catch (std::exception& e) {
+                cerr << "Warning: couldn't record the history: " << e.what() << endl;
+            }
         }
     }
 
 
     void
-    print()
+    dispatch()
     {
-        cout << std::boolalpha;
+        if (history_runs > 0) {
+            report_history(read_history(history_filename()), history_runs, cout);
+            return;
+        }
+
+        if (!merge_dir.empty()) {
+            if (out_file.empty())
+                throw std::runtime_error{"--merge-snapshots requires --out."};
+            merge_snapshots(merge_dir, out_file, clog);
+            return;
+        }
+
+        if (!query.empty()) {
+            if (index_file.empty())
+                throw std::runtime_error{"--query requires --index."};
+            auto eq = query.raw().find('=');
+            if (eq == std::string::npos)
+                throw std::runtime_error{"--query must be in the form KEY=VALUE."};
+            query_index(index_file,
+                        query.raw().substr(0, eq),
+                        query.raw().substr(eq + 1),
+                        cout);
+            return;
+        }
+
+        if (!digest_compare.empty()) {
+            if (digest_compare.size() != 2)
+                throw std::runtime_error{"--digest-compare must be given twice."};
+            auto a = ServiceDigest::read(digest_compare[0]);
+            auto b = ServiceDigest::read(digest_compare[1]);
+            if (compare_digests(a, b, cout))
+                cout << "Identical.\n";
+            return;
+        }
+
+        if (digest_flag) {
+            print_digest();
+            return;
+        }
+
+        if (generate_flag) {
+            GenerateOptions options;
+            options.bus = to_bus.raw();
+            options.seed = seed;
+            options.collections = std::max(num_collections, 0);
+            options.items = std::max(num_items, 0);
+            options.jobs = std::max(jobs, 1);
+            generate_keyring(options, cout);
+            return;
+        }
+
+        if (sync_flag) {
+            SyncOptions options;
+            options.from_bus = from_bus.raw();
+            options.to_bus = to_bus.raw();
+            options.unlock = unlock_flag;
+            options.dry_run = dry_run_flag;
+            options.jobs = std::max(jobs, 1);
+            sync_services(options, cout);
+            return;
+        }
+
+        if (format_name == "text")
+            format = Format::Text;
+        else if (format_name == "grouped")
+            format = Format::Grouped;
+        else if (format_name == "json")
+            format = Format::Json;
+        else
+            throw std::runtime_error{"Unknown format: \"" + format_name.raw() + "\""};
+
+        if (binary_name == "hex")
+            binary = BinaryEncoding::Hex;
+        else if (binary_name == "base64")
+            binary = BinaryEncoding::Base64;
+        else if (binary_name == "base64url")
+            binary = BinaryEncoding::Base64Url;
+        else if (binary_name == "raw")
+            binary = BinaryEncoding::Raw;
+        else
+            throw std::runtime_error{"Unknown binary encoding: \"" + binary_name.raw() + "\""};
+        if (binary == BinaryEncoding::Raw && format != Format::Text)
+            throw std::runtime_error{"--binary=raw can't be used with --format=" +
+                                     format_name.raw() + "."};
+
+        if (filtering()) {
+            if (detail < Detail::Items)
+                throw std::runtime_error{"Filtering items requires --detail=2 or more."};
+            if (split_flag || output_name != "stdout")
+                throw std::runtime_error{"Filtering items is not supported with --split or"
+                                         " --output."};
+            if (!where.empty() && where.raw().find('=') == std::string::npos)
+                throw std::runtime_error{"--where must be in the form KEY=VALUE."};
+        }
+
+        // the fetcher only sends the lock state of items that --detail shows
+        if (!item_paths.empty()) {
+            read_item_paths();
+            if (detail < Detail::Items)
+                throw std::runtime_error{"--item requires --detail=2 or more."};
+            if (filtering() || plan_flag || !collection_name.empty()
+                || output_name != "stdout")
+                throw std::runtime_error{"--item can't be used with filters, --plan,"
+                                         " --collection or --output."};
+        }
 
+        if (split_flag && format == Format::Grouped)
+            throw std::runtime_error{"--split can't be used with --format=grouped."};
+
+        // the journal gets one entry per object, without formatting or secrets
+        if (output_name == "journal"
+            && (format != Format::Text || plan_flag || bulk_flag || split_flag || slowest > 0))
+            throw std::runtime_error{"--output=journal can't be used with --format, --plan,"
+                                     " --bulk-secrets, --split or --slowest."};
+
+        if (errors_name == "inline")
+            error_mode = ErrorMode::Inline;
+        else if (errors_name == "summary")
+            error_mode = ErrorMode::Summary;
+        else if (errors_name == "json")
+            error_mode = ErrorMode::Json;
+        else
+            throw std::runtime_error{"Unknown error mode: \"" + errors_name.raw() + "\""};
+
+        // not a PhaseTimer, which would leave out the phases inside it
+        auto started = CostTable::clock::now();
+        std::optional<CallCounter> calls;
+        if (record_history_flag)
+            calls.emplace();
+        if (output_name == "journal")
+            print_journal();
+        else if (output_name != "stdout")
+            throw std::runtime_error{"Unknown output: \"" + output_name.raw() + "\""};
+        else if (format == Format::Grouped) {
+            GroupedFormatter f{cout, binary, detail >= Detail::Secrets};
+            print(f);
+            f.finish();
+        } else if (format == Format::Json) {
+            JsonFormatter f{cout, binary};
+            list(f);
+            f.finish();
+        } else {
+            TextFormatter f{cout, binary};
+            list(f);
+            f.finish();
+        }
+        auto elapsed = CostTable::clock::now() - started;
+        stats.phase_us[HistoryRecord::Total] =
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        // with --split, the fetcher's calls were already added
+        if (calls)
+            stats.round_trips += calls->get();
+
+        // on stderr, so the report never ends up inside the listing
+        if (error_mode == ErrorMode::Summary)
+            errors.print_summary(cerr);
+        else if (error_mode == ErrorMode::Json)
+            errors.print_json(cerr);
+        if (slowest > 0)
+            costs.report(cerr, slowest);
+
+        listed = true;
+    }
+
+
+    static
+    std::string
+    history_filename()
+    {
+        return Glib::build_filename(Glib::get_user_data_dir(), "lssecrets/history");
+    }
+
+
+    void
+    record_history()
+    {
+        stats.timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::string_view version = PACKAGE_VERSION;
+        version.copy(stats.version, sizeof stats.version);
+        stats.detail = detail;
+        if (unlock_flag)
+            stats.options |= HistoryRecord::OptUnlock;
+        if (bulk_flag)
+            stats.options |= HistoryRecord::OptBulk;
+        if (format == Format::Grouped)
+            stats.options |= HistoryRecord::OptGrouped;
+        if (error_mode != ErrorMode::Inline)
+            stats.options |= HistoryRecord::OptErrors;
+        if (!output_file.empty())
+            stats.options |= HistoryRecord::OptOutputFile;
+        if (slowest > 0)
+            stats.options |= HistoryRecord::OptSlowest;
+
+        rusage usage;
+        if (!::getrusage(RUSAGE_SELF, &usage))
+            stats.peak_rss_kib = usage.ru_maxrss;
+
+        auto filename = history_filename();
+        std::filesystem::create_directories(std::filesystem::path{filename}.parent_path());
+        append_history(filename, stats);
+    }
+
+
+    template<typename F>
+    void
+    list(F& f)
+    {
+        if (split_flag)
+            print_split(f);
+        else
+            print(f);
+    }
+
+
+    template<typename F>
+    void
+    print(F& f)
+    {
         GError* service_error = nullptr;
-        int flags = SECRET_SERVICE_LOAD_COLLECTIONS;
-        if (detail >= Detail::Secrets)
+        int flags = service_flags();
+        // the bulk fetcher opens its own session
+        if (detail >= Detail::Secrets && !bulk_secrets())
             flags |= SECRET_SERVICE_OPEN_SESSION;
 
-        service = take(secret_service_get_sync(SecretServiceFlags(flags),
-                                               nullptr,
-                                               &service_error));
+        auto start = CostTable::clock::now();
+        {
+            PhaseTimer t{stats.phase_us[HistoryRecord::Connect]};
+            service = take(secret_service_get_sync(SecretServiceFlags(flags),
+                                                   nullptr,
+                                                   &service_error));
+        }
         if (service_error)
             throw_error(service_error);
+        // the object path is only known after the proxy is loaded
+        auto service_cost = costs.add("service", g_dbus_proxy_get_object_path(*service));
+        costs.add_time(service_cost, CostTable::Load, CostTable::clock::now() - start);
+
+        if (bulk_secrets()) {
+            auto t = costs.time(service_cost, CostTable::Load);
+            PhaseTimer pt{stats.phase_us[HistoryRecord::Connect]};
+            bulk.emplace(*service);
+        }
 
+        f.service(g_dbus_proxy_get_object_path(*service));
 
-        cout << "Service\n";
-        cout << "  Path: "
-             << g_dbus_proxy_get_object_path(*service)
-             << '\n';
+        if (!item_paths.empty()) {
+            f.end_service();
+            print_items(f);
+            bulk.reset();
+            return;
+        }
 
-        // check known aliases
-        const std::vector<std::string> known_aliases{
-            "default", "login", "session"
-        };
         std::map<std::string, std::string> aliases;
-        std::multimap<std::string, std::string> reverse_aliases;
-        for (const auto& alias : known_aliases) {
-            auto path = to_string(secret_service_read_alias_dbus_path_sync(*service,
-                                                                           alias.c_str(),
-                                                                           nullptr,
-                                                                           nullptr));
-            if (path) {
-                aliases[alias] = *path;
-                reverse_aliases.emplace(*path, alias);
-            }
-        }
-        if (!aliases.empty()) {
-            cout << "  Aliases:\n";
-            for (auto& [alias, path] : aliases)
-                cout << "    "
-                     << alias
-                     << ": "
-                     << path
-                     << '\n';
+        {
+            auto t = costs.time(service_cost, CostTable::Load);
+            PhaseTimer pt{stats.phase_us[HistoryRecord::Aliases]};
+            aliases = resolve_aliases();
         }
+        for (auto& [alias, path] : aliases)
+            f.alias(alias, path);
 
-        cout << '\n';
+        f.end_service();
 
         if (detail < Detail::Collections)
             return;
 
-        auto collections = to_vector<SecretCollection>(secret_service_get_collections(*service));
-        for (auto& col : collections) {
-            print(col, reverse_aliases, "    ");
-            cout << '\n';
-        }
+        PhaseTimer t{stats.phase_us[HistoryRecord::Listing]};
+        auto collections = get_collections(aliases);
+        stats.collections += collections.size();
+        if (filtering())
+            filter_items(f, collections);
+        if (plan_flag)
+            print_planned(f, collections);
+        else
+            for (auto& col : collections) {
+                print(f, col);
+                f.end_collection();
+            }
+
+        // close the session while the connection is still up
+        bulk.reset();
 
     }
 
 
+    template<typename F>
     void
-    print(GObjectWrapper<SecretCollection>& col,
-          const std::multimap<std::string, std::string>& reverse_aliases,
-          const std::string& indent)
+    print(F& f,
+          GObjectWrapper<SecretCollection>& col)
     {
-        auto label = to_string(secret_collection_get_label(col));
-        cout << indent
-             << "Collection: \""
-             << label.value()
-             << "\"\n";
-
-        cout << indent
-             << "  Path: "
-             << g_dbus_proxy_get_object_path(col)
-             << '\n';
-
-        // check if there's an alias for this collection
-        auto path = g_dbus_proxy_get_object_path(col);
-        auto range = reverse_aliases.equal_range(path);
-        for (auto& i = range.first; i != range.second; ++i)
-            cout << indent
-                 << "  Alias: "
-                 << i->second
-                 << '\n';
+        const char* path = g_dbus_proxy_get_object_path(col);
+        auto cost_id = costs.add("collection", path);
 
-        auto created = secret_collection_get_created(col);
-        if (created)
-            cout << indent
-                 << "  Created: "
-                 << timestamp_to_string(created).value()
-                 << '\n';
-
-        auto modified = secret_collection_get_modified(col);
-        if (modified)
-            cout << indent
-                 << "  Modified: "
-                 << timestamp_to_string(modified).value()
-                 << '\n';
+        auto label = to_string(secret_collection_get_label(col)).value_or("");
+        costs.add_bytes(cost_id, label.size());
+        f.begin_collection(path,
+                           label,
+                           secret_collection_get_created(col),
+                           secret_collection_get_modified(col));
 
         if (unlock_flag && secret_collection_get_locked(col)) {
-            auto error = unlock(col);
-            if (error)
-                cout << indent << "  Error: " << error->what() << endl;
+            auto t = costs.time(cost_id, CostTable::Unlock);
+            if (auto error = unlock(col))
+                report_error(f, path, error);
         }
-        bool locked = secret_collection_get_locked(col);
-        cout << indent << "  Locked: " << locked << '\n';
-
-        cout << '\n';
+        f.collection_locked(secret_collection_get_locked(col));
 
         if (detail < Detail::Items)
             return;
 
-        auto items = to_vector<SecretItem>(secret_collection_get_items(col));
+        auto items = get_items(f, col);
+        std::erase_if(items,
+                      [this](GObjectWrapper<SecretItem>& item)
+                      {
+                          return !is_selected(item);
+                      });
+        stats.items += items.size();
+
+        if (bulk) {
+            // print_planned() may have fetched them already
+            std::vector<std::string> paths;
+            for (auto& item : items) {
+                const char* path = g_dbus_proxy_get_object_path(item);
+                if (!secret_item_get_locked(item) && !prefetched.contains(path))
+                    paths.push_back(path);
+            }
+            if (!paths.empty()) {
+                auto t = costs.time(cost_id, CostTable::Secret);
+                PhaseTimer pt{stats.phase_us[HistoryRecord::Secrets]};
+                prefetched.merge(bulk->fetch(paths));
+            }
+        }
+
         for (auto& item : items) {
-            print(item, indent + "    ");
-            cout << '\n';
+            print(f, item);
+            f.end_item();
+            if (unlock_pending)
+                poll_events();
         }
 
     }
 
 
-    void
-    print(GObjectWrapper<SecretItem>& item,
-          const std::string& indent)
+    bool
+    filtering()
+        const noexcept
     {
-        auto label = to_string(secret_item_get_label(item));
-        cout << indent
-             << "Item: \""
-             << label.value()
-             << "\"\n";
+        return !modified_since.empty() || locked_only_flag || !where.empty();
+    }
 
-        cout << indent
-             << "  Path: "
-             << g_dbus_proxy_get_object_path(item)
-             << '\n';
 
-        auto created = secret_item_get_created(item);
-        if (created)
-            cout << indent
-                 << "  Created: "
-                 << timestamp_to_string(created).value()
-                 << '\n';
+    /*
+     * Loads every item into the item table, from the proxies already loaded, selects
+     * the ones that pass the filters, and drops the collections with none selected.
+     */
+    template<typename F>
+    void
+    filter_items(F& f,
+                 std::vector<GObjectWrapper<SecretCollection>>& collections)
+    {
+        table.emplace();
+        std::optional<std::string> key, value;
+        if (!where.empty()) {
+            auto eq = where.raw().find('=');
+            key = where.raw().substr(0, eq);
+            value = where.raw().substr(eq + 1);
+        }
 
-        auto modified = secret_item_get_modified(item);
-        if (modified)
-            cout << indent
-                 << "  Modified: "
-                 << timestamp_to_string(modified).value()
-                 << '\n';
+        for (auto& col : collections) {
+            table->add_collection(g_dbus_proxy_get_object_path(col));
+            for (auto& item : get_items(f, col)) {
+                std::map<std::string, std::string> attributes;
+                if (key)
+                    attributes = to_map(secret_item_get_attributes(item));
+                auto label = to_string(secret_item_get_label(item));
+                table->add_item(g_dbus_proxy_get_object_path(item),
+                                label.value_or(""),
+                                secret_item_get_created(item),
+                                secret_item_get_modified(item),
+                                secret_item_get_locked(item),
+                                key ? &attributes : nullptr);
+            }
+        }
+        table->finish();
+
+        selection = table->select_all();
+        if (!modified_since.empty())
+            table->filter_modified_since(selection, parse_time(modified_since.raw()));
+        if (locked_only_flag)
+            table->filter_locked(selection, true);
+        if (key)
+            table->filter_attribute(selection, *key, *value);
+
+        // the table's collections are in the same order
+        std::uint32_t index = 0;
+        std::erase_if(collections,
+                      [this, &index](GObjectWrapper<SecretCollection>&)
+                      {
+                          auto& c = table->get_collection(index++);
+                          return !table->any_selected(selection, c.first_row, c.end_row);
+                      });
+    }
 
-        if (detail < Detail::Attributes)
-            return;
 
-        auto attributes = to_map(secret_item_get_attributes(item));
-        if (!attributes.empty()) {
-            static const std::string attrib_indent = indent + "    ";
-            cout << indent << "  Attributes:\n";
-            for (auto& [key, val] : attributes) {
-                cout << attrib_indent
-                     << "  \""
-                     << key
-                     << "\" = \""
-                     << val
-                     << "\"\n";
+    /*
+     * Replaces a "-" given to --item with the paths read from stdin, one per line. Every
+     * path must be a valid object path inside a collection's path, since the collection
+     * is loaded from it.
+     */
+    void
+    read_item_paths()
+    {
+        std::vector<Glib::ustring> paths;
+        for (auto& path : item_paths) {
+            if (path != "-") {
+                paths.push_back(path);
+                continue;
             }
+            std::string line;
+            while (std::getline(std::cin, line)) {
+                auto first = line.find_first_not_of(" \t\r");
+                if (first == std::string::npos)
+                    continue;
+                auto last = line.find_last_not_of(" \t\r");
+                paths.push_back(line.substr(first, last - first + 1));
+            }
+        }
+        for (auto& path : paths) {
+            auto sep = path.raw().rfind('/');
+            if (!g_variant_is_object_path(path.c_str())
+                || sep == 0 || sep == std::string::npos
+                || !g_variant_is_object_path(path.raw().substr(0, sep).c_str()))
+                throw std::runtime_error{"Invalid item path: \"" + path.raw() + "\""};
         }
+        item_paths = std::move(paths);
+    }
+
 
-        auto print_locked = [&item, indent] {
-            bool locked = secret_item_get_locked(item);
-            cout << indent << "  Locked: " << locked << '\n';
+    /*
+     * Lists only the items given with --item, by collection. The proxies of the items
+     * and their collections are created in parallel, without loading anything else from
+     * the service; locked items are unlocked in one call, and the secrets are fetched in
+     * one call.
+     */
+    template<typename F>
+    void
+    print_items(F& f)
+    {
+        PhaseTimer t{stats.phase_us[HistoryRecord::Listing]};
+
+        struct Group {
+            std::string path;
+            GObjectWrapper<SecretCollection> col;
+            std::vector<GObjectWrapper<SecretItem>> items;
         };
 
-        if (unlock_flag && secret_item_get_locked(item)) {
-            auto error = unlock(item);
-            print_locked();
-            if (error) {
-                cout << indent << "  Error: " << error->what() << endl;
-                return;
+        // in the order the collections are first seen
+        std::vector<Group> groups;
+        std::unordered_map<std::string, std::size_t> group_of;
+        std::unordered_set<std::string> seen;
+        std::vector<std::pair<std::size_t, std::string>> paths;
+        for (auto& path : item_paths) {
+            if (!seen.insert(path.raw()).second)
+                continue;
+            // an item's path is inside its collection's path
+            std::string col_path = path.raw().substr(0, path.raw().rfind('/'));
+            auto [it, inserted] = group_of.try_emplace(col_path, groups.size());
+            if (inserted)
+                groups.push_back(Group{col_path, {}, {}});
+            paths.emplace_back(it->second, path.raw());
+        }
+        for (auto& [group, path] : paths)
+            groups[group].items.emplace_back();
+
+        // the groups don't move from here on
+        Pipeline pipeline{static_cast<std::size_t>(std::max(jobs, 1))};
+        for (auto& group : groups)
+            pipeline.add(group.path,
+                         [this, &group](GAsyncReadyCallback cb, gpointer data)
+                         {
+                             secret_collection_new_for_dbus_path(*service,
+                                                                 group.path.c_str(),
+                                                                 SECRET_COLLECTION_NONE,
+                                                                 nullptr,
+                                                                 cb,
+                                                                 data);
+                         },
+                         [&group](GObject*, GAsyncResult* result, GError** error)
+                         {
+                             group.col = take(secret_collection_new_for_dbus_path_finish(result,
+                                                                                          error));
+                             return group.col.get() != nullptr;
+                         });
+        std::vector<std::size_t> next(groups.size());
+        for (auto& [group, path] : paths) {
+            auto& item = groups[group].items[next[group]++];
+            pipeline.add(path,
+                         [this, &path](GAsyncReadyCallback cb, gpointer data)
+                         {
+                             secret_item_new_for_dbus_path(*service,
+                                                           path.c_str(),
+                                                           SECRET_ITEM_NONE,
+                                                           nullptr,
+                                                           cb,
+                                                           data);
+                         },
+                         [&item](GObject*, GAsyncResult* result, GError** error)
+                         {
+                             item = take(secret_item_new_for_dbus_path_finish(result, error));
+                             return item.get() != nullptr;
+                         });
+        }
+        pipeline.run();
+
+        // entries are "path: message"
+        for (auto& msg : pipeline.get_errors()) {
+            auto sep = msg.find(": ");
+            std::string path = msg.substr(0, sep);
+            report_error(f, path.c_str(), std::string_view{msg}.substr(sep + 2));
+        }
+
+        for (auto& group : groups)
+            std::erase_if(group.items,
+                          [](GObjectWrapper<SecretItem>& item)
+                          {
+                              return !item.get();
+                          });
+        std::erase_if(groups,
+                      [](Group& group)
+                      {
+                          return !group.col.get() || group.items.empty();
+                      });
+
+        GList* to_unlock = nullptr;
+        if (unlock_flag)
+            for (auto& group : groups)
+                for (auto& item : group.items)
+                    if (secret_item_get_locked(item))
+                        to_unlock = g_list_prepend(to_unlock, item.get());
+        if (to_unlock) {
+            to_unlock = g_list_reverse(to_unlock);
+            PhaseTimer t{stats.phase_us[HistoryRecord::Unlock]};
+            GError* error = nullptr;
+            secret_service_unlock_sync(*service, to_unlock, nullptr, nullptr, &error);
+            g_list_free(to_unlock);
+            if (error)
+                report_error(f, g_dbus_proxy_get_object_path(*service), error);
+        }
+
+        if (bulk) {
+            std::vector<std::string> unlocked;
+            for (auto& group : groups)
+                for (auto& item : group.items)
+                    if (!secret_item_get_locked(item))
+                        unlocked.push_back(g_dbus_proxy_get_object_path(item));
+            if (!unlocked.empty()) {
+                PhaseTimer t{stats.phase_us[HistoryRecord::Secrets]};
+                prefetched.merge(bulk->fetch(unlocked));
+            }
+        }
+
+        // don't prompt again, one item at a time, for what the batch didn't unlock
+        bool old_unlock_flag = std::exchange(unlock_flag, false);
+        try {
+            for (auto& group : groups) {
+                ++stats.collections;
+                stats.items += group.items.size();
+                auto label = to_string(secret_collection_get_label(group.col)).value_or("");
+                f.begin_collection(group.path,
+                                   label,
+                                   secret_collection_get_created(group.col),
+                                   secret_collection_get_modified(group.col));
+                f.collection_locked(secret_collection_get_locked(group.col));
+                for (auto& item : group.items) {
+                    print(f, item);
+                    f.end_item();
+                }
+                f.end_collection();
             }
+        }
+        catch (...) {
+            unlock_flag = old_unlock_flag;
+            throw;
+        }
+        unlock_flag = old_unlock_flag;
+    }
+
+
+    /*
+     * Sorts the collections by lock state, from the loaded proxies. Locked collections
+     * and items are unlocked in one asynchronous call, while the unlocked collections are
+     * printed; with --bulk-secrets, each group's secrets are fetched in a single call.
+     */
+    template<typename F>
+    void
+    print_planned(F& f,
+                  std::vector<GObjectWrapper<SecretCollection>>& collections)
+    {
+        std::vector<GObjectWrapper<SecretCollection>*> ready;
+        std::vector<GObjectWrapper<SecretCollection>*> locked;
+        GList* to_unlock = nullptr;
+
+        for (auto& col : collections) {
+            bool any_locked = secret_collection_get_locked(col);
+            if (any_locked && unlock_flag)
+                to_unlock = g_list_prepend(to_unlock, col.get());
+            if (detail >= Detail::Items)
+                for (auto& item : get_items(f, col))
+                    if (is_selected(item) && secret_item_get_locked(item)) {
+                        any_locked = true;
+                        // items are only unlocked from --detail=3 on, to show attributes
+                        if (unlock_flag && detail >= Detail::Attributes)
+                            to_unlock = g_list_prepend(to_unlock, item.get());
+                    }
+            (any_locked ? locked : ready).push_back(&col);
+        }
+
+        struct UnlockState {
+            bool done = false;
+            GError* error = nullptr;
+        } unlock_state;
+
+        if (to_unlock) {
+            to_unlock = g_list_reverse(to_unlock);
+            secret_service_unlock(*service,
+                                  to_unlock,
+                                  nullptr,
+                                  [](GObject* source, GAsyncResult* result, gpointer data)
+                                  {
+                                      auto& state = *static_cast<UnlockState*>(data);
+                                      secret_service_unlock_finish(SECRET_SERVICE(source),
+                                                                   result,
+                                                                   nullptr,
+                                                                   &state.error);
+                                      state.done = true;
+                                  },
+                                  &unlock_state);
+            g_list_free(to_unlock);
+            // get the prompt up before listing anything
+            poll_events();
         } else
-            print_locked();
+            unlock_state.done = true;
+
+        auto prefetch = [this, &f](const std::vector<GObjectWrapper<SecretCollection>*>& group)
+        {
+            if (!bulk || detail < Detail::Items)
+                return;
+            std::vector<std::string> paths;
+            for (auto col : group)
+                for (auto& item : get_items(f, *col))
+                    if (is_selected(item) && !secret_item_get_locked(item))
+                        paths.push_back(g_dbus_proxy_get_object_path(item));
+            if (paths.empty())
+                return;
+            PhaseTimer t{stats.phase_us[HistoryRecord::Secrets]};
+            prefetched.merge(bulk->fetch(paths));
+        };
+
+        // the unlock call only makes progress while the main context is iterated
+        unlock_pending = !unlock_state.done;
+        try {
+            prefetch(ready);
+            for (auto col : ready) {
+                print(f, *col);
+                f.end_collection();
+                // show them while the user answers the prompt
+                f.flush();
+                if (!unlock_state.done)
+                    poll_events();
+            }
+        }
+        catch (...) {
+            unlock_pending = false;
+            throw;
+        }
+        unlock_pending = false;
+
+        {
+            PhaseTimer t{stats.phase_us[HistoryRecord::Unlock]};
+            while (!unlock_state.done)
+                g_main_context_iteration(nullptr, TRUE);
+            // let the proxies see the new Locked properties
+            poll_events();
+        }
+        if (unlock_state.error)
+            report_error(f, g_dbus_proxy_get_object_path(*service), unlock_state.error);
 
-        if (detail < Detail::Secrets)
+        // don't prompt again, one object at a time, for what the batch didn't unlock
+        bool old_unlock_flag = std::exchange(unlock_flag, false);
+        try {
+            prefetch(locked);
+            for (auto col : locked) {
+                print(f, *col);
+                f.end_collection();
+            }
+        }
+        catch (...) {
+            unlock_flag = old_unlock_flag;
+            throw;
+        }
+        unlock_flag = old_unlock_flag;
+    }
+
+
+    template<typename F>
+    void
+    print(F& f,
+          GObjectWrapper<SecretItem>& item)
+    {
+        const char* path = g_dbus_proxy_get_object_path(item);
+        auto cost_id = costs.add("item", path);
+
+        auto label = to_string(secret_item_get_label(item)).value_or("");
+        costs.add_bytes(cost_id, label.size());
+        f.begin_item(path,
+                     label,
+                     secret_item_get_created(item),
+                     secret_item_get_modified(item));
+
+        // a row always has the lock state
+        if (detail < Detail::Attributes && !F::item_rows)
             return;
 
+        if (detail >= Detail::Attributes) {
+            // already loaded with the proxy
+            std::unique_ptr<GHashTable, void (*)(GHashTable*)> attributes{
+                secret_item_get_attributes(item),
+                g_hash_table_unref
+            };
+            sorted_entries(attributes.get(), attribute_entries);
+            for (auto [key, val] : attribute_entries) {
+                costs.add_bytes(cost_id, key.size() + val.size());
+                f.attribute(key, val);
+            }
+        }
+
+        GError* unlock_error = nullptr;
+        if (unlock_flag && secret_item_get_locked(item)) {
+            auto t = costs.time(cost_id, CostTable::Unlock);
+            unlock_error = unlock(item);
+        }
+        bool locked = secret_item_get_locked(item);
+        f.item_locked(locked);
+        if (unlock_error) {
+            report_error(f, path, unlock_error);
+            return;
+        }
+
+        if (detail < Detail::Secrets || (F::item_rows && locked))
+            return;
+
+        auto found = prefetched.find(path);
+        if (found != prefetched.end()) {
+            auto& secret = found->second;
+            costs.add_bytes(cost_id, secret.value.size());
+            std::string_view data{reinterpret_cast<const char*>(secret.value.data()),
+                                  secret.value.size()};
+            f.secret(secret.content_type, is_text_secret(secret.content_type, data), data);
+            prefetched.erase(found);
+            return;
+        }
+
         GError* error = nullptr;
-        if (!secret_item_load_secret_sync(item, nullptr, &error)) {
-            cout << indent << "  Error: " << to_error(error).what() << endl;
+        bool loaded;
+        {
+            auto t = costs.time(cost_id, CostTable::Secret);
+            PhaseTimer pt{stats.phase_us[HistoryRecord::Secrets]};
+            loaded = secret_item_load_secret_sync(item, nullptr, &error);
+        }
+        if (!loaded) {
+            report_error(f, path, error);
             return;
         }
 
         auto val = secret_item_get_secret(item);
-        if (val) {
-            cout << indent << "  Secret:\n";
-
-            auto type = secret_value_get_content_type(val);
-            cout << indent
-                 << "    Type: "
-                 << type
-                 << '\n';
-
-            auto text = secret_value_get_text(val);
-            if (text) {
-                cout << indent
-                     << "    Value: \""
-                     << text
-                     << "\"\n";
-            } else {
-                gsize len = 0;
-                auto ptr = secret_value_get(val, &len);
-                auto repr = to_string(ptr, len);
-                cout << indent
-                     << "    Value: { "
-                     << repr
-                     << " } (hex)\n";
+        if (!val) {
+            report_error(f, path, "secret is null");
+            return;
+        }
+        gsize len = 0;
+        std::string_view data{secret_value_get(val, &len), len};
+        costs.add_bytes(cost_id, len);
+        const char* type = secret_value_get_content_type(val);
+        std::string_view content_type = type ? type : "";
+        f.secret(content_type, is_text_secret(content_type, data), data);
+        secret_value_unref(val);
+    }
+
+
+    /*
+     * Collections are only loaded up front when all of them are listed, and --slowest
+     * doesn't need to time each one.
+     */
+    int
+    service_flags()
+        const noexcept
+    {
+        if (detail >= Detail::Collections && collection_name.empty() && item_paths.empty()
+            && slowest <= 0)
+            return SECRET_SERVICE_LOAD_COLLECTIONS;
+        return SECRET_SERVICE_NONE;
+    }
+
+
+    // Secrets of the items given with --item are always fetched in one call.
+    bool
+    bulk_secrets()
+        const noexcept
+    {
+        return detail >= Detail::Secrets && (bulk_flag || !item_paths.empty());
+    }
+
+
+    std::map<std::string, std::string>
+    resolve_aliases()
+    {
+        std::string cache_file;
+        std::string bus = to_string(g_dbus_proxy_get_name(*service)).value_or("");
+        std::vector<std::string> paths;
+        auto now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+
+        if (cache_aliases_flag) {
+            cache_file = Glib::build_filename(Glib::get_user_cache_dir(), "lssecrets/aliases");
+            paths = get_collection_paths(*service);
+            auto cache = AliasCache::read(cache_file);
+            if (cache && cache->matches(bus, paths, now))
+                return cache->aliases;
+        }
+
+        std::map<std::string, std::string> aliases;
+        for (const char* alias : {"default", "login", "session"}) {
+            auto path = to_string(secret_service_read_alias_dbus_path_sync(*service,
+                                                                           alias,
+                                                                           nullptr,
+                                                                           nullptr));
+            if (path)
+                aliases[alias] = *path;
+        }
+
+        if (cache_aliases_flag) {
+            AliasCache cache{bus, now, std::move(paths), aliases};
+            try {
+                cache.write(cache_file);
             }
+            catch (std::exception& e) {
+                // the listing is still correct without the cache
+                cerr << "Warning: " << e.what() << endl;
+            }
+        }
 
-            secret_value_unref(val);
-        } else {
-            cout << indent
-                 << "  Error: secret is null\n";
+        return aliases;
+    }
+
+
+    /*
+     * Returns all collections, or only the one selected by --collection. An alias is
+     * resolved without loading the other collections.
+     */
+    std::vector<GObjectWrapper<SecretCollection>>
+    get_collections(const std::map<std::string, std::string>& aliases)
+    {
+        if (collection_name.empty()) {
+            if (!costs.enabled)
+                return to_vector<SecretCollection>(secret_service_get_collections(*service));
+            std::vector<GObjectWrapper<SecretCollection>> result;
+            for (auto& path : get_object_paths(*service, "Collections"))
+                result.push_back(load_collection(path, SECRET_COLLECTION_NONE));
+            return result;
+        }
+
+        const std::string& name = collection_name.raw();
+        std::optional<std::string> path;
+        if (auto found = aliases.find(name); found != aliases.end())
+            path = found->second;
+        else {
+            path = to_string(secret_service_read_alias_dbus_path_sync(*service,
+                                                                      name.c_str(),
+                                                                      nullptr,
+                                                                      nullptr));
+        }
+
+        std::vector<GObjectWrapper<SecretCollection>> result;
+
+        if (path) {
+            // with --slowest, get_items() loads them one at a time
+            auto flags = detail >= Detail::Items && !costs.enabled
+                ? SECRET_COLLECTION_LOAD_ITEMS
+                : SECRET_COLLECTION_NONE;
+            result.push_back(load_collection(*path, flags));
+            return result;
+        }
+
+        // not an alias, so look for the label
+        GError* error = nullptr;
+        {
+            auto cost_id = costs.add("service", g_dbus_proxy_get_object_path(*service));
+            auto t = costs.time(cost_id, CostTable::Load);
+            if (!secret_service_load_collections_sync(*service, nullptr, &error))
+                throw_error(error);
+        }
+        for (auto& col : to_vector<SecretCollection>(secret_service_get_collections(*service)))
+            if (to_string(secret_collection_get_label(col)) == name)
+                result.push_back(std::move(col));
+        if (result.empty())
+            throw std::runtime_error{"No collection with alias or label \"" + name + "\"."};
+        return result;
+    }
+
+
+    GObjectWrapper<SecretCollection>
+    load_collection(const std::string& path,
+                    SecretCollectionFlags flags)
+    {
+        auto t = costs.time(costs.add("collection", path.c_str()), CostTable::Load);
+        GError* error = nullptr;
+        auto col = take(secret_collection_new_for_dbus_path_sync(*service,
+                                                                 path.c_str(),
+                                                                 flags,
+                                                                 nullptr,
+                                                                 &error));
+        if (error)
+            throw_error(error);
+        return col;
+    }
+
+
+    /*
+     * The items of a collection. Unless libsecret loaded them with the collection, as it
+     * does without --slowest, each item is loaded here, once, so its own cost is measured.
+     */
+    template<typename F>
+    std::vector<GObjectWrapper<SecretItem>>
+    get_items(F& f,
+              GObjectWrapper<SecretCollection>& col)
+    {
+        if (secret_collection_get_flags(col) & SECRET_COLLECTION_LOAD_ITEMS)
+            return to_vector<SecretItem>(secret_collection_get_items(col));
+
+        auto [it, inserted] = loaded_items.try_emplace(g_dbus_proxy_get_object_path(col));
+        if (inserted)
+            for (auto& path : get_object_paths(col, "Items")) {
+                auto t = costs.time(costs.add("item", path.c_str()), CostTable::Load);
+                GError* error = nullptr;
+                auto item = take(secret_item_new_for_dbus_path_sync(*service,
+                                                                    path.c_str(),
+                                                                    SECRET_ITEM_NONE,
+                                                                    nullptr,
+                                                                    &error));
+                if (error)
+                    report_error(f, path.c_str(), error);
+                else
+                    it->second.push_back(std::move(item));
+            }
+        return it->second;
+    }
+
+
+    void
+    get_service(int flags)
+    {
+        GError* error = nullptr;
+        service = take(secret_service_get_sync(SecretServiceFlags(flags),
+                                               nullptr,
+                                               &error));
+        if (error)
+            throw_error(error);
+    }
+
+
+    /*
+     * Starts this program again as the fetcher, which holds the Secret Service session,
+     * and passes the records it writes to the shared ring to the formatter, in place.
+     */
+    template<typename F>
+    void
+    print_split(F& f)
+    {
+        SharedRing ring;
+
+        std::vector<std::string> args{
+            "lssecrets",
+            "--split-fetcher=" + std::to_string(ring.fd()),
+            "--detail=" + std::to_string(detail)
+        };
+        if (unlock_flag)
+            args.push_back("--unlock");
+        if (bulk_flag)
+            args.push_back("--bulk-secrets");
+        if (cache_aliases_flag)
+            args.push_back("--cache-aliases");
+        if (plan_flag)
+            args.push_back("--plan");
+        if (slowest > 0)
+            args.push_back("--slowest=" + std::to_string(slowest));
+        args.push_back("--jobs=" + std::to_string(jobs));
+        if (!collection_name.empty())
+            args.push_back("--collection=" + collection_name.raw());
+        for (auto& path : item_paths)
+            args.push_back("--item=" + path.raw());
+        std::vector<char*> argv;
+        for (auto& arg : args)
+            argv.push_back(arg.data());
+        argv.push_back(nullptr);
+
+        pid_t pid;
+        if (int e = ::posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr,
+                                  argv.data(), environ))
+            throw std::system_error{e, std::generic_category(), "posix_spawn()"};
+
+        // don't leave the fetcher blocked on a full ring if formatting fails
+        struct Reaper {
+            pid_t pid;
+
+            ~Reaper()
+            {
+                if (pid == -1)
+                    return;
+                ::kill(pid, SIGKILL);
+                ::waitpid(pid, nullptr, 0);
+            }
+        } reaper{pid};
+
+        // 0 = service, 1 = collection, 2 = item
+        int depth = 0;
+        bool fetcher_exited = false;
+
+        for (;;) {
+            auto rec = ring.read(100ms);
+            if (!rec) {
+                // records written right before exiting are read on the next pass
+                if (fetcher_exited)
+                    throw std::runtime_error{"The fetcher process exited unexpectedly."};
+                if (::waitpid(pid, nullptr, WNOHANG) == pid) {
+                    reaper.pid = -1;
+                    fetcher_exited = true;
+                }
+                continue;
+            }
+
+            auto& fields = rec->fields;
+            switch (rec->type) {
+
+            case RecService:
+                f.service(fields[0]);
+                break;
+
+            case RecAlias:
+                f.alias(fields[0], fields[1]);
+                break;
+
+            case RecCollection:
+                ++stats.collections;
+                depth = 1;
+                f.begin_collection(fields[0],
+                                   fields[1],
+                                   from_field<guint64>(fields[2]),
+                                   from_field<guint64>(fields[3]));
+                break;
+
+            case RecItem:
+                ++stats.items;
+                depth = 2;
+                f.begin_item(fields[0],
+                             fields[1],
+                             from_field<guint64>(fields[2]),
+                             from_field<guint64>(fields[3]));
+                break;
+
+            case RecAttribute:
+                f.attribute(fields[0], fields[1]);
+                break;
+
+            case RecLocked:
+                if (depth == 2)
+                    f.item_locked(from_field<bool>(fields[0]));
+                else
+                    f.collection_locked(from_field<bool>(fields[0]));
+                break;
+
+            case RecSecret:
+                f.secret(fields[0], from_field<bool>(fields[1]), fields[2]);
+                break;
+
+            case RecError:
+            {
+                std::string path{fields[0]};
+                report_error(f, path.c_str(), fields[1]);
+                break;
+            }
+
+            case RecDone:
+                if (depth == 2)
+                    f.end_item();
+                else if (depth == 1)
+                    f.end_collection();
+                else
+                    f.end_service();
+                if (depth)
+                    --depth;
+                break;
+
+            case RecEnd:
+                stats.round_trips += from_field<std::uint32_t>(fields[0]);
+                ring.release();
+                ::waitpid(pid, nullptr, 0);
+                reaper.pid = -1;
+                return;
+
+            case RecFatal:
+                throw std::runtime_error{std::string{fields[0]}};
+
+            }
+
+            ring.release();
         }
     }
 
 
+    // Runs in the process started by print_split().
+    void
+    split_fetch()
+    {
+        // the formatter may be killed while this process waits on the ring
+        ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+        SharedRing ring = SharedRing::attach(split_fd);
+        try {
+            CallCounter calls;
+            RingFormatter f{ring};
+            print(f);
+            std::uint32_t made = calls.get();
+            ring.write(RecEnd, {as_field(made)});
+            // the costs were measured here, so they're reported from here
+            if (slowest > 0)
+                costs.report(cerr, slowest);
+        }
+        catch (std::exception& e) {
+            ring.write(RecFatal, {e.what()});
+        }
+    }
+
+
+    void
+    print_journal()
+    {
+        get_service(service_flags());
+
+        JournalSink journal;
+
+        if (detail < Detail::Collections)
+            return;
+
+        // --collection looks the alias up in the service, since aliases aren't logged
+        auto collections = get_collections({});
+        stats.collections += collections.size();
+        for (auto& col : collections) {
+            const char* col_path = g_dbus_proxy_get_object_path(col);
+
+            if (unlock_flag && secret_collection_get_locked(col))
+                if (auto error = unlock(col))
+                    report_error("", "Error: ", col_path, error);
+
+            auto label = to_string(secret_collection_get_label(col)).value_or("");
+            JournalSink::Entry entry;
+            entry.add("MESSAGE", "Collection \"" + label + "\"");
+            entry.add("SYSLOG_IDENTIFIER", PACKAGE_NAME);
+            entry.add("COLLECTION_PATH", col_path);
+            entry.add("LABEL", label);
+            if (auto modified = secret_collection_get_modified(col))
+                entry.add("MODIFIED", std::to_string(modified));
+            entry.add("LOCKED", secret_collection_get_locked(col) ? "true" : "false");
+            journal.submit(std::move(entry));
+
+            if (detail < Detail::Items)
+                continue;
+
+            auto items = to_vector<SecretItem>(secret_collection_get_items(col));
+            stats.items += items.size();
+            for (auto& item : items) {
+                const char* item_path = g_dbus_proxy_get_object_path(item);
+
+                if (unlock_flag && secret_item_get_locked(item))
+                    if (auto error = unlock(item))
+                        report_error("", "Error: ", item_path, error);
+
+                auto item_label = to_string(secret_item_get_label(item)).value_or("");
+                JournalSink::Entry entry;
+                entry.add("MESSAGE", "Item \"" + item_label + "\"");
+                entry.add("SYSLOG_IDENTIFIER", PACKAGE_NAME);
+                entry.add("COLLECTION_PATH", col_path);
+                entry.add("ITEM_PATH", item_path);
+                entry.add("LABEL", item_label);
+                if (auto modified = secret_item_get_modified(item))
+                    entry.add("MODIFIED", std::to_string(modified));
+                entry.add("LOCKED", secret_item_get_locked(item) ? "true" : "false");
+                if (detail >= Detail::Attributes)
+                    for (auto& [key, val] : to_map(secret_item_get_attributes(item)))
+                        entry.add_normalized("ATTR_", key, val);
+                journal.submit(std::move(entry));
+            }
+        }
+
+        journal.flush();
+    }
+
+
+    void
+    print_digest()
+    {
+        get_service(SECRET_SERVICE_LOAD_COLLECTIONS | SECRET_SERVICE_OPEN_SESSION);
+
+        // secrets are never digested without a key; the default one is made on first use
+        std::string key;
+        if (digest_key.empty())
+            key = read_digest_key(Glib::build_filename(Glib::get_user_data_dir(),
+                                                       "lssecrets/digest-key"),
+                                  true);
+        else
+            key = read_digest_key(digest_key, false);
+
+        std::optional<ServiceDigest> cache;
+        if (!digest_cache.empty() && std::filesystem::exists(digest_cache))
+            cache = ServiceDigest::read(digest_cache);
+
+        auto digest = compute_digest(*service,
+                                     cache ? &*cache : nullptr,
+                                     key,
+                                     unlock_flag,
+                                     clog);
+        digest.write(cout);
+
+        if (!digest_cache.empty()) {
+            // replace the cache atomically, so an interrupted run leaves the old one
+            std::string tmp = digest_cache + ".tmp";
+            {
+                std::ofstream out{tmp, std::ios::trunc};
+                digest.write(out);
+                out.close();
+                if (!out)
+                    throw std::runtime_error{"Couldn't write \"" + tmp + "\"."};
+            }
+            std::filesystem::rename(tmp, digest_cache);
+        }
+    }
+
+
+    // Takes ownership of the error.
+    void
+    report_error(const std::string& indent,
+                 std::string_view label,
+                 const char* path,
+                 GError* error)
+    {
+        if (error_mode == ErrorMode::Inline)
+            cout << indent << label << to_error(error).what() << '\n';
+        else
+            errors.add(error, path);
+    }
+
+
+    // Takes ownership of the error.
+    template<typename F>
+    void
+    report_error(F& f,
+                 const char* path,
+                 GError* error)
+    {
+        if (error_mode == ErrorMode::Inline)
+            f.error(path, to_error(error).what());
+        else
+            errors.add(error, path);
+    }
+
+
+    template<typename F>
+    void
+    report_error(F& f,
+                 const char* path,
+                 std::string_view message)
+    {
+        if (error_mode == ErrorMode::Inline)
+            f.error(path, message);
+        else
+            errors.add(message, path);
+    }
+
+
+    // Whether the filters kept the item; all items are kept when not filtering.
+    bool
+    is_selected(GObjectWrapper<SecretItem>& item)
+        const
+    {
+        if (!table)
+            return true;
+        auto row = table->find(g_dbus_proxy_get_object_path(item));
+        return row && ItemTable::is_selected(selection, *row);
+    }
+
+
+    // Dispatches whatever is pending on the main context, without blocking.
+    static
+    void
+    poll_events()
+    {
+        while (g_main_context_iteration(nullptr, FALSE))
+            ;
+    }
+
+
+    // Returns the error, if any.
     template<typename T>
-    std::optional<std::runtime_error>
+    GError*
     unlock(GObjectWrapper<T>& obj)
     {
+        PhaseTimer t{stats.phase_us[HistoryRecord::Unlock]};
         GList* unlock_list = g_list_append(nullptr, obj.get());
         GError* error = nullptr;
         secret_service_unlock_sync(*service,
@@ -620,10 +2363,7 @@ struct App : Gio::Application {
                                    &error);
         g_list_free(unlock_list);
 
-        if (error)
-            return to_error(error);
-
-        return {};
+        return error;
     }
 
 };
@@ -635,5 +2375,6 @@ main(int argc, char *argv[])
     Gio::init();
 
     App app;
-    return app.run(argc, argv);
+    int status = app.run(argc, argv);
+    return status ? status : app.exit_status;
 }
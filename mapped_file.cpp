@@ -0,0 +1,73 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+
+MappedFile::MappedFile(const std::string& filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::system_error{errno, std::generic_category(), filename};
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1) {
+        int e = errno;
+        ::close(fd);
+        throw std::system_error{e, std::generic_category(), filename};
+    }
+
+    len = st.st_size;
+    if (len) {
+        void* p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error{e, std::generic_category(), filename};
+        }
+        ::madvise(p, len, MADV_SEQUENTIAL);
+        ptr = static_cast<const char*>(p);
+    }
+    ::close(fd);
+}
+
+
+MappedFile::MappedFile(MappedFile&& other)
+    noexcept :
+    ptr{std::exchange(other.ptr, nullptr)},
+    len{std::exchange(other.len, 0)}
+{}
+
+
+MappedFile&
+MappedFile::operator =(MappedFile&& other)
+    noexcept
+{
+    if (this != &other) {
+        if (ptr)
+            ::munmap(const_cast<char*>(ptr), len);
+        ptr = std::exchange(other.ptr, nullptr);
+        len = std::exchange(other.len, 0);
+    }
+    return *this;
+}
+
+
+MappedFile::~MappedFile()
+{
+    if (ptr)
+        ::munmap(const_cast<char*>(ptr), len);
+}
@@ -0,0 +1,61 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+    const char* ptr = nullptr;
+    std::size_t len = 0;
+
+public:
+
+    MappedFile() noexcept = default;
+
+    explicit
+    MappedFile(const std::string& filename);
+
+    MappedFile(MappedFile&& other) noexcept;
+
+    MappedFile& operator =(MappedFile&& other) noexcept;
+
+    ~MappedFile();
+
+
+    const char*
+    data()
+        const noexcept
+    {
+        return ptr;
+    }
+
+
+    std::size_t
+    size()
+        const noexcept
+    {
+        return len;
+    }
+
+
+    std::string_view
+    view()
+        const noexcept
+    {
+        return {ptr, len};
+    }
+
+};
+
+
+#endif
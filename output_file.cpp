@@ -0,0 +1,253 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "output_file.hpp"
+
+
+namespace {
+
+
+    constexpr std::size_t mmap_window_size = 64 * 1024 * 1024;
+    constexpr std::size_t direct_buffer_size = 8 * 1024 * 1024;
+    constexpr std::size_t direct_alignment = 4096;
+    // the reservation grows by half of what it already is, in 64 KiB units, up to this much
+    constexpr std::uint64_t reserve_granularity = 64 * 1024;
+    constexpr std::uint64_t max_reserve_step = 1024 * 1024 * 1024;
+
+
+    [[noreturn]]
+    void
+    throw_errno(const std::string& what)
+    {
+        throw std::system_error{errno, std::generic_category(), what};
+    }
+
+
+} // namespace
+
+
+OutputFile::OutputFile(const std::string& filename,
+                       bool direct_io) :
+    filename{filename},
+    direct_io{direct_io},
+    window_size{direct_io ? direct_buffer_size : mmap_window_size}
+{
+    std::vector<char> templ(filename.begin(), filename.end());
+    for (char c : ".XXXXXX")
+        templ.push_back(c);
+    fd = ::mkostemp(templ.data(), O_CLOEXEC);
+    if (fd == -1)
+        throw_errno(filename);
+    tmp_filename = templ.data();
+
+    if (direct_io) {
+        int flags = ::fcntl(fd, F_GETFL);
+        if (flags == -1 || ::fcntl(fd, F_SETFL, flags | O_DIRECT) == -1) {
+            int e = errno;
+            ::close(fd);
+            ::unlink(tmp_filename.c_str());
+            throw std::system_error{e, std::generic_category(), "O_DIRECT"};
+        }
+    }
+
+    try {
+        if (direct_io || !map_window())
+            start_buffer();
+    }
+    catch (...) {
+        ::close(fd);
+        ::unlink(tmp_filename.c_str());
+        throw;
+    }
+}
+
+
+OutputFile::~OutputFile()
+{
+    if (mapped)
+        unmap_window();
+    else
+        std::free(window);
+    if (fd != -1)
+        ::close(fd);
+    if (!committed)
+        ::unlink(tmp_filename.c_str());
+}
+
+
+bool
+OutputFile::reserve(std::uint64_t size)
+{
+    if (size <= reserved)
+        return true;
+    std::uint64_t step = std::min(reserved / 2, max_reserve_step);
+    size = std::max(size, reserved + step);
+    size = (size + reserve_granularity - 1) / reserve_granularity * reserve_granularity;
+    int e = ::posix_fallocate(fd, 0, size);
+    if (e == EOPNOTSUPP || e == EINVAL)
+        return false;
+    if (e)
+        throw std::system_error{e, std::generic_category(), tmp_filename};
+    reserved = size;
+    return true;
+}
+
+
+bool
+OutputFile::map_window()
+{
+    void* p = ::mmap(nullptr, window_size, PROT_WRITE, MAP_SHARED, fd, window_offset);
+    if (p == MAP_FAILED)
+        throw_errno(tmp_filename);
+    ::madvise(p, window_size, MADV_SEQUENTIAL);
+    window = static_cast<char*>(p);
+    mapped = true;
+    setp(window, window);
+    if (!grow_put_area()) {
+        unmap_window();
+        return false;
+    }
+    return true;
+}
+
+
+bool
+OutputFile::grow_put_area()
+{
+    // a sparse file would turn a full disk into a SIGBUS on the mapping, so the put area
+    // only covers what's preallocated
+    std::size_t used = pptr() - pbase();
+    if (!reserve(window_offset + (epptr() - pbase()) + 1))
+        return false;
+    setp(window, window + std::min<std::uint64_t>(reserved - window_offset, window_size));
+    pbump(static_cast<int>(used));
+    return true;
+}
+
+
+void
+OutputFile::unmap_window()
+{
+    if (!window)
+        return;
+    ::munmap(window, window_size);
+    window = nullptr;
+    mapped = false;
+    setp(nullptr, nullptr);
+}
+
+
+void
+OutputFile::start_buffer()
+{
+    window_size = direct_buffer_size;
+    void* buf = nullptr;
+    int e = ::posix_memalign(&buf, direct_alignment, window_size);
+    if (e)
+        throw std::system_error{e, std::generic_category(), "posix_memalign()"};
+    window = static_cast<char*>(buf);
+    setp(window, window + window_size);
+}
+
+
+void
+OutputFile::write_buffer(std::size_t len)
+{
+    std::size_t done = 0;
+    while (done < len) {
+        auto r = ::pwrite(fd, window + done, len - done, window_offset + done);
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            throw_errno(tmp_filename);
+        }
+        done += r;
+    }
+}
+
+
+OutputFile::int_type
+OutputFile::overflow(int_type ch)
+{
+    try {
+        // the put area is full: hand it over to the disk and move on
+        if (!mapped) {
+            write_buffer(window_size);
+            window_offset += window_size;
+            setp(window, window + window_size);
+        } else if (epptr() < window + window_size) {
+            if (!grow_put_area()) {
+                // what was written stays in the file; the rest goes through write()
+                std::size_t used = pptr() - pbase();
+                unmap_window();
+                window_offset += used;
+                start_buffer();
+            }
+        } else {
+            unmap_window();
+            // start writeback now, instead of when the page cache fills up
+            ::sync_file_range(fd, window_offset, window_size, SYNC_FILE_RANGE_WRITE);
+            window_offset += window_size;
+            if (!map_window())
+                start_buffer();
+        }
+    }
+    catch (std::exception& e) {
+        error = e.what();
+        return traits_type::eof();
+    }
+
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+        return traits_type::not_eof(ch);
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+}
+
+
+void
+OutputFile::commit()
+{
+    std::size_t used = pptr() - pbase();
+    std::uint64_t final_size = window_offset + used;
+
+    if (direct_io) {
+        // O_DIRECT needs whole blocks; the padding is truncated away below
+        std::size_t padded = (used + direct_alignment - 1) / direct_alignment * direct_alignment;
+        std::memset(window + used, 0, padded - used);
+        write_buffer(padded);
+    } else if (!mapped) {
+        write_buffer(used);
+    } else {
+        unmap_window();
+    }
+
+    if (::ftruncate(fd, final_size) == -1)
+        throw_errno(tmp_filename);
+    if (::fsync(fd) == -1)
+        throw_errno(tmp_filename);
+    if (::close(fd) == -1) {
+        fd = -1;
+        throw_errno(tmp_filename);
+    }
+    fd = -1;
+    if (::rename(tmp_filename.c_str(), filename.c_str()) == -1)
+        throw_errno(filename);
+    committed = true;
+}
@@ -0,0 +1,105 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef OUTPUT_FILE_HPP
+#define OUTPUT_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include <string>
+
+
+/*
+ * Stream buffer that writes a file for large exports.
+ *
+ * Data goes to a temporary file in the same directory, preallocated in growing steps and
+ * written through a sliding memory-mapped window (or, with direct I/O, through large
+ * aligned writes that bypass the page cache). Where the filesystem can't preallocate, it
+ * is written with plain write() calls instead, since a sparse mapping can't report a full
+ * disk. commit() truncates the file to the final size and renames it over the
+ * destination, so readers never see a partial file. If commit() is never called, the
+ * temporary file is removed.
+ */
+class OutputFile : public std::streambuf {
+public:
+
+    OutputFile(const std::string& filename,
+               bool direct_io);
+
+
+    OutputFile(const OutputFile&) = delete;
+
+
+    ~OutputFile();
+
+
+    void
+    commit();
+
+
+    // Why the last write failed, if it did.
+    const std::string&
+    get_error()
+        const noexcept
+    {
+        return error;
+    }
+
+protected:
+
+    int_type
+    overflow(int_type ch)
+        override;
+
+private:
+
+    // False if the filesystem doesn't support preallocation.
+    bool
+    reserve(std::uint64_t size);
+
+
+    // False if the window can't be preallocated, so it wasn't mapped.
+    bool
+    map_window();
+
+
+    // Preallocates more of the window for the put area; false if the filesystem can't.
+    bool
+    grow_put_area();
+
+
+    void
+    unmap_window();
+
+
+    // Switches to writing the put area out with write() calls.
+    void
+    start_buffer();
+
+
+    void
+    write_buffer(std::size_t len);
+
+
+    std::string filename;
+    std::string tmp_filename;
+    int fd = -1;
+    bool direct_io;
+    bool committed = false;
+    bool mapped = false;
+    std::string error;
+
+    char* window = nullptr;
+    std::size_t window_size;
+    std::uint64_t window_offset = 0; // file offset of the start of the put area
+    std::uint64_t reserved = 0;      // bytes preallocated on disk
+
+};
+
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "pipeline.hpp"
+#include "utils.hpp"
+
+
+Pipeline::Pipeline(std::size_t max_in_flight) :
+    max_in_flight{std::max<std::size_t>(1, max_in_flight)}
+{}
+
+
+void
+Pipeline::add(std::string description,
+              Start start,
+              Finish finish)
+{
+    pending.push_back(Call{this, std::move(description), std::move(start), std::move(finish)});
+}
+
+
+void
+Pipeline::run()
+{
+    while (!pending.empty() || in_flight) {
+        while (!pending.empty() && in_flight < max_in_flight) {
+            auto call = std::make_unique<Call>(std::move(pending.front()));
+            pending.pop_front();
+            ++in_flight;
+            auto start = call->start;
+            start(&Pipeline::on_ready, call.release());
+        }
+        g_main_context_iteration(nullptr, TRUE);
+    }
+}
+
+
+void
+Pipeline::on_ready(GObject* source,
+                   GAsyncResult* result,
+                   gpointer data)
+{
+    std::unique_ptr<Call> call{static_cast<Call*>(data)};
+    auto& self = *call->pipeline;
+    --self.in_flight;
+    ++self.completed;
+
+    GError* error = nullptr;
+    if (!call->finish(source, result, &error) && error)
+        self.errors.push_back(call->description + ": " + to_error(error).what());
+}
@@ -0,0 +1,91 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <libsecret-1/libsecret/secret.h>
+
+
+/*
+ * Runs asynchronous libsecret calls with a bounded number of them in flight, dispatching
+ * their results on the default main context.
+ */
+class Pipeline {
+public:
+
+    // Starts the call, passing the callback and user data to the async function.
+    using Start = std::function<void (GAsyncReadyCallback, gpointer)>;
+
+    // Completes the call with the matching _finish() function.
+    using Finish = std::function<bool (GObject*, GAsyncResult*, GError**)>;
+
+
+    explicit
+    Pipeline(std::size_t max_in_flight);
+
+
+    void
+    add(std::string description,
+        Start start,
+        Finish finish);
+
+
+    // Returns when all calls have completed.
+    void
+    run();
+
+
+    std::size_t
+    get_completed()
+        const noexcept
+    {
+        return completed;
+    }
+
+
+    // One "description: message" entry per failed call.
+    const std::vector<std::string>&
+    get_errors()
+        const noexcept
+    {
+        return errors;
+    }
+
+private:
+
+    struct Call {
+        Pipeline* pipeline;
+        std::string description;
+        Start start;
+        Finish finish;
+    };
+
+
+    static
+    void
+    on_ready(GObject* source,
+             GAsyncResult* result,
+             gpointer data);
+
+
+    std::size_t max_in_flight;
+    std::size_t in_flight = 0;
+    std::size_t completed = 0;
+    std::deque<Call> pending;
+    std::vector<std::string> errors;
+
+};
+
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SECURE_BUFFER_HPP
+#define SECURE_BUFFER_HPP
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/*
+ * Buffer that is locked in RAM, and wiped when freed.
+ *
+ * Locks don't nest, so every buffer has pages of its own: unlocking one never unlocks
+ * the memory of another.
+ */
+class SecureBuffer {
+    unsigned char* ptr = nullptr;
+    std::size_t len = 0;
+    std::size_t capacity = 0;
+
+public:
+
+    SecureBuffer() noexcept = default;
+
+
+    explicit
+    SecureBuffer(std::size_t size) :
+        len{size}
+    {
+        if (!size)
+            return;
+        static const std::size_t page_size = ::sysconf(_SC_PAGESIZE);
+        capacity = (size + page_size - 1) / page_size * page_size;
+        void* p = ::mmap(nullptr,
+                         capacity,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1,
+                         0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc{};
+        ptr = static_cast<unsigned char*>(p);
+        // best effort: without CAP_IPC_LOCK this may fail when RLIMIT_MEMLOCK is low
+        ::mlock(ptr, capacity);
+    }
+
+
+    SecureBuffer(SecureBuffer&& other)
+        noexcept :
+        ptr{std::exchange(other.ptr, nullptr)},
+        len{std::exchange(other.len, 0)},
+        capacity{std::exchange(other.capacity, 0)}
+    {}
+
+
+    SecureBuffer&
+    operator =(SecureBuffer&& other)
+        noexcept
+    {
+        if (this != &other) {
+            destroy();
+            ptr = std::exchange(other.ptr, nullptr);
+            len = std::exchange(other.len, 0);
+            capacity = std::exchange(other.capacity, 0);
+        }
+        return *this;
+    }
+
+
+    ~SecureBuffer()
+    {
+        destroy();
+    }
+
+
+    unsigned char*
+    data()
+        noexcept
+    {
+        return ptr;
+    }
+
+
+    const unsigned char*
+    data()
+        const noexcept
+    {
+        return ptr;
+    }
+
+
+    std::size_t
+    size()
+        const noexcept
+    {
+        return len;
+    }
+
+
+    // Only shrinks; the tail is wiped immediately.
+    void
+    shrink(std::size_t new_size)
+        noexcept
+    {
+        if (new_size < len) {
+            ::explicit_bzero(ptr + new_size, len - new_size);
+            len = new_size;
+        }
+    }
+
+private:
+
+    void
+    destroy()
+        noexcept
+    {
+        if (!ptr)
+            return;
+        ::explicit_bzero(ptr, capacity);
+        ::munlock(ptr, capacity);
+        ::munmap(ptr, capacity);
+        ptr = nullptr;
+    }
+
+};
+
+
+#endif
@@ -0,0 +1,463 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "snapshot.hpp"
+#include "mapped_file.hpp"
+
+
+namespace {
+
+
+    /*
+     * Index file layout; all integers are in native byte order.
+     *
+     *   IndexHeader
+     *   std::uint32_t string_offsets[num_strings + 1]
+     *   char          string_data[]            (padded to 4 bytes)
+     *   Term          terms[num_terms]         (sorted by key, value)
+     *   Posting       postings[num_postings]   (grouped by term)
+     *
+     * Strings (hosts, paths, keys and values) are stored once, sorted, so string ids
+     * compare the same way as the strings themselves.
+     */
+    struct IndexHeader {
+        char magic[8];
+        std::uint32_t num_strings;
+        std::uint32_t num_terms;
+        std::uint32_t num_postings;
+        std::uint32_t reserved;
+        std::uint64_t strings_offset;
+        std::uint64_t terms_offset;
+        std::uint64_t postings_offset;
+    };
+
+    constexpr char index_magic[8] = {'L', 'S', 'S', 'I', 'D', 'X', '0', '1'};
+
+
+    struct Term {
+        std::uint32_t key;
+        std::uint32_t value;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+
+    struct Posting {
+        std::uint32_t host;
+        std::uint32_t path;
+    };
+
+
+    struct Attribute {
+        std::string_view path;
+        std::string_view key;
+        std::string_view value;
+    };
+
+
+    struct HostDump {
+        std::string host;
+        std::string filename;
+        MappedFile file;
+        std::vector<Attribute> attributes;
+    };
+
+
+    std::string_view
+    trim_left(std::string_view s)
+        noexcept
+    {
+        auto pos = s.find_first_not_of(' ');
+        if (pos == std::string_view::npos)
+            return {};
+        return s.substr(pos);
+    }
+
+
+    // Extracts (item path, key, value) from the text layout printed by App::print().
+    void
+    parse(HostDump& dump)
+    {
+        std::string_view text = dump.file.view();
+        std::string_view item_path;
+        bool in_item = false;
+
+        while (!text.empty()) {
+            auto eol = text.find('\n');
+            auto line = trim_left(text.substr(0, eol));
+            text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+            if (line.starts_with("Collection: ")) {
+                in_item = false;
+            } else if (line.starts_with("Item: ")) {
+                in_item = true;
+                item_path = {};
+            } else if (in_item && line.starts_with("Path: ")) {
+                item_path = line.substr(6);
+            } else if (in_item
+                       && !item_path.empty()
+                       && line.size() >= 2
+                       && line.front() == '"'
+                       && line.back() == '"') {
+                auto sep = line.find("\" = \"");
+                if (sep == std::string_view::npos)
+                    continue;
+                auto key = line.substr(1, sep - 1);
+                auto value = line.substr(sep + 5, line.size() - sep - 6);
+                dump.attributes.push_back({item_path, key, value});
+            }
+        }
+    }
+
+
+    class StringPool {
+        std::unordered_map<std::string_view, std::uint32_t> ids;
+        std::vector<std::string_view> strings;
+
+    public:
+
+        std::uint32_t
+        intern(std::string_view s)
+        {
+            auto [it, inserted] = ids.try_emplace(s, strings.size());
+            if (inserted)
+                strings.push_back(s);
+            return it->second;
+        }
+
+
+        // Sorts the strings, returns the mapping from old ids to new ids.
+        std::vector<std::uint32_t>
+        sort()
+        {
+            std::vector<std::uint32_t> order(strings.size());
+            for (std::uint32_t i = 0; i < order.size(); ++i)
+                order[i] = i;
+            std::sort(order.begin(), order.end(),
+                      [this](std::uint32_t a, std::uint32_t b)
+                      {
+                          return strings[a] < strings[b];
+                      });
+
+            std::vector<std::uint32_t> remap(strings.size());
+            std::vector<std::string_view> sorted(strings.size());
+            for (std::uint32_t i = 0; i < order.size(); ++i) {
+                remap[order[i]] = i;
+                sorted[i] = strings[order[i]];
+            }
+            strings = std::move(sorted);
+            ids.clear();
+            return remap;
+        }
+
+
+        const std::vector<std::string_view>&
+        get()
+            const noexcept
+        {
+            return strings;
+        }
+    };
+
+
+    void
+    load_parallel(std::vector<HostDump>& dumps)
+    {
+        std::atomic<std::size_t> next = 0;
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        auto worker = [&]
+        {
+            for (;;) {
+                std::size_t i = next++;
+                if (i >= dumps.size())
+                    return;
+                try {
+                    dumps[i].file = MappedFile{dumps[i].filename};
+                    parse(dumps[i]);
+                }
+                catch (...) {
+                    std::lock_guard guard{error_mutex};
+                    if (!error)
+                        error = std::current_exception();
+                    next = dumps.size();
+                }
+            }
+        };
+
+        unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+        num_threads = std::min<std::size_t>(num_threads, dumps.size());
+        std::vector<std::jthread> threads;
+        for (unsigned t = 1; t < num_threads; ++t)
+            threads.emplace_back(worker);
+        worker();
+        threads.clear();
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+
+    template<typename T>
+    void
+    write_array(std::ofstream& out,
+                const std::vector<T>& v)
+    {
+        out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+    }
+
+
+    std::uint64_t
+    align4(std::uint64_t n)
+        noexcept
+    {
+        return (n + 3) & ~std::uint64_t{3};
+    }
+
+
+    std::string_view
+    get_string(const MappedFile& file,
+               const IndexHeader& header,
+               std::uint32_t id)
+    {
+        auto offsets = reinterpret_cast<const std::uint32_t*>(file.data()
+                                                              + header.strings_offset);
+        const char* base = reinterpret_cast<const char*>(offsets + header.num_strings + 1);
+        return {base + offsets[id], offsets[id + 1] - offsets[id]};
+    }
+
+
+    // Checks that every section and string lies inside the file.
+    bool
+    valid_index(const MappedFile& file,
+                const IndexHeader& header)
+    {
+        std::uint64_t size = file.size();
+        if (header.strings_offset < sizeof header
+            || header.strings_offset > size
+            || header.terms_offset > size
+            || header.postings_offset > size
+            || header.strings_offset % 4
+            || header.terms_offset % 4
+            || header.postings_offset % 4)
+            return false;
+
+        std::uint64_t data_offset = header.strings_offset
+            + (std::uint64_t{header.num_strings} + 1) * sizeof(std::uint32_t);
+        if (data_offset > header.terms_offset
+            || header.terms_offset + std::uint64_t{header.num_terms} * sizeof(Term)
+               > header.postings_offset
+            || header.postings_offset + std::uint64_t{header.num_postings} * sizeof(Posting)
+               != size)
+            return false;
+
+        auto offsets = reinterpret_cast<const std::uint32_t*>(file.data()
+                                                              + header.strings_offset);
+        if (offsets[0] != 0)
+            return false;
+        for (std::uint32_t i = 0; i < header.num_strings; ++i)
+            if (offsets[i + 1] < offsets[i])
+                return false;
+        return data_offset + offsets[header.num_strings] <= header.terms_offset;
+    }
+
+
+    std::optional<std::uint32_t>
+    find_string(const MappedFile& file,
+                const IndexHeader& header,
+                std::string_view s)
+    {
+        std::uint32_t lo = 0;
+        std::uint32_t hi = header.num_strings;
+        while (lo < hi) {
+            std::uint32_t mid = lo + (hi - lo) / 2;
+            if (get_string(file, header, mid) < s)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < header.num_strings && get_string(file, header, lo) == s)
+            return lo;
+        return {};
+    }
+
+
+} // namespace
+
+
+void
+merge_snapshots(const std::string& dir,
+                const std::string& index_file,
+                std::ostream& log)
+{
+    std::vector<HostDump> dumps;
+    for (auto& entry : std::filesystem::directory_iterator{dir}) {
+        if (!entry.is_regular_file())
+            continue;
+        HostDump dump;
+        // not stem(), which would turn "web01.example.com" into "web01.example"
+        dump.host = entry.path().filename().string();
+        if (dump.host.size() > 4 && dump.host.ends_with(".txt"))
+            dump.host.resize(dump.host.size() - 4);
+        dump.filename = entry.path().string();
+        dumps.push_back(std::move(dump));
+    }
+    if (dumps.empty())
+        throw std::runtime_error{"No snapshots found in \"" + dir + "\"."};
+
+    load_parallel(dumps);
+
+    // The dumps vector is no longer resized, so views into the host names stay valid.
+    StringPool pool;
+    std::vector<std::tuple<std::uint32_t, std::uint32_t,
+                           std::uint32_t, std::uint32_t>> entries;
+    for (auto& dump : dumps) {
+        auto host = pool.intern(dump.host);
+        for (auto& attr : dump.attributes)
+            entries.emplace_back(pool.intern(attr.key),
+                                 pool.intern(attr.value),
+                                 host,
+                                 pool.intern(attr.path));
+    }
+
+    auto remap = pool.sort();
+    for (auto& [key, value, host, path] : entries) {
+        key = remap[key];
+        value = remap[value];
+        host = remap[host];
+        path = remap[path];
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+    std::vector<Term> terms;
+    std::vector<Posting> postings;
+    postings.reserve(entries.size());
+    for (auto& [key, value, host, path] : entries) {
+        if (terms.empty() || terms.back().key != key || terms.back().value != value)
+            terms.push_back({key, value, std::uint32_t(postings.size()), 0});
+        ++terms.back().count;
+        postings.push_back({host, path});
+    }
+
+    auto& strings = pool.get();
+    std::vector<std::uint32_t> offsets;
+    offsets.reserve(strings.size() + 1);
+    std::uint64_t data_size = 0;
+    for (auto s : strings) {
+        offsets.push_back(data_size);
+        data_size += s.size();
+    }
+    offsets.push_back(data_size);
+    if (data_size > UINT32_MAX)
+        throw std::runtime_error{"Too much string data for the index format."};
+
+    IndexHeader header{};
+    std::memcpy(header.magic, index_magic, sizeof header.magic);
+    header.num_strings = strings.size();
+    header.num_terms = terms.size();
+    header.num_postings = postings.size();
+    header.strings_offset = sizeof header;
+    header.terms_offset = align4(header.strings_offset
+                                 + offsets.size() * sizeof(std::uint32_t)
+                                 + data_size);
+    header.postings_offset = header.terms_offset + terms.size() * sizeof(Term);
+
+    std::ofstream out{index_file, std::ios::binary | std::ios::trunc};
+    if (!out)
+        throw std::runtime_error{"Couldn't create \"" + index_file + "\"."};
+    out.write(reinterpret_cast<const char*>(&header), sizeof header);
+    write_array(out, offsets);
+    for (auto s : strings)
+        out.write(s.data(), s.size());
+    static const char padding[4] = {};
+    out.write(padding, header.terms_offset - (header.strings_offset
+                                              + offsets.size() * sizeof(std::uint32_t)
+                                              + data_size));
+    write_array(out, terms);
+    write_array(out, postings);
+    out.close();
+    if (!out)
+        throw std::runtime_error{"Couldn't write \"" + index_file + "\"."};
+
+    log << "Merged "
+        << dumps.size()
+        << " snapshots: "
+        << strings.size()
+        << " strings, "
+        << terms.size()
+        << " attribute values, "
+        << postings.size()
+        << " postings.\n";
+}
+
+
+void
+query_index(const std::string& index_file,
+            const std::string& key,
+            const std::string& value,
+            std::ostream& out)
+{
+    MappedFile file{index_file};
+
+    IndexHeader header;
+    if (file.size() < sizeof header)
+        throw std::runtime_error{"\"" + index_file + "\" is not an index."};
+    std::memcpy(&header, file.data(), sizeof header);
+    if (std::memcmp(header.magic, index_magic, sizeof header.magic))
+        throw std::runtime_error{"\"" + index_file + "\" is not an index."};
+    if (!valid_index(file, header))
+        throw std::runtime_error{"\"" + index_file + "\" is corrupt."};
+
+    auto key_id = find_string(file, header, key);
+    auto value_id = find_string(file, header, value);
+    if (!key_id || !value_id)
+        return;
+
+    auto terms = reinterpret_cast<const Term*>(file.data() + header.terms_offset);
+    auto terms_end = terms + header.num_terms;
+    auto term = std::lower_bound(terms, terms_end, std::pair{*key_id, *value_id},
+                                 [](const Term& t, const std::pair<std::uint32_t,
+                                                                   std::uint32_t>& kv)
+                                 {
+                                     return std::pair{t.key, t.value} < kv;
+                                 });
+    if (term == terms_end || term->key != *key_id || term->value != *value_id)
+        return;
+
+    if (std::uint64_t{term->first} + term->count > header.num_postings)
+        throw std::runtime_error{"\"" + index_file + "\" is corrupt."};
+
+    auto postings = reinterpret_cast<const Posting*>(file.data() + header.postings_offset);
+    for (std::uint32_t i = 0; i < term->count; ++i) {
+        auto& p = postings[term->first + i];
+        if (p.host >= header.num_strings || p.path >= header.num_strings)
+            throw std::runtime_error{"\"" + index_file + "\" is corrupt."};
+        out << get_string(file, header, p.host)
+            << ' '
+            << get_string(file, header, p.path)
+            << '\n';
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <ostream>
+#include <string>
+
+
+/*
+ * A snapshot is the output of `lssecrets --detail=3` for one host, stored as
+ * `<dir>/<host>.txt` or `<dir>/<host>`. Only a ".txt" suffix is stripped, so host names
+ * keep all their dots.
+ *
+ * merge_snapshots() reads all snapshots in parallel and writes an index that maps each
+ * attribute (key, value) pair to the (host, item path) pairs that have it.
+ */
+void
+merge_snapshots(const std::string& dir,
+                const std::string& index_file,
+                std::ostream& log);
+
+
+// Prints "host path" for every item that has the attribute key = value.
+void
+query_index(const std::string& index_file,
+            const std::string& key,
+            const std::string& value,
+            std::ostream& out);
+
+
+#endif
@@ -0,0 +1,339 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "split_ring.hpp"
+
+
+namespace {
+
+
+    constexpr std::uint32_t pad_type = 0xffffffff;
+
+    constexpr std::size_t control_size = 4096;
+
+
+    struct RecordHeader {
+        std::uint32_t size; // including this header and the alignment padding
+        std::uint32_t type;
+        std::uint32_t num_fields;
+        std::uint32_t reserved;
+    };
+
+
+    std::size_t
+    align8(std::size_t n)
+        noexcept
+    {
+        return (n + 7) & ~std::size_t{7};
+    }
+
+
+    std::size_t
+    record_size(std::initializer_list<std::string_view> fields)
+        noexcept
+    {
+        std::size_t size = sizeof(RecordHeader);
+        for (auto& f : fields)
+            size += sizeof(std::uint32_t) + f.size();
+        return align8(size);
+    }
+
+
+    std::uint32_t*
+    futex_word(std::atomic<std::uint32_t>& a)
+        noexcept
+    {
+        return reinterpret_cast<std::uint32_t*>(&a);
+    }
+
+
+    // Not FUTEX_PRIVATE_FLAG: the waiter and the waker are in different processes.
+    void
+    futex_wait(std::atomic<std::uint32_t>& word,
+               std::uint32_t expected,
+               const timespec* timeout)
+        noexcept
+    {
+        ::syscall(SYS_futex, futex_word(word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+    }
+
+
+    void
+    futex_wake(std::atomic<std::uint32_t>& word)
+        noexcept
+    {
+        ::syscall(SYS_futex, futex_word(word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+
+
+    [[noreturn]]
+    void
+    throw_errno(const char* what)
+    {
+        throw std::system_error{errno, std::generic_category(), what};
+    }
+
+
+} // namespace
+
+
+/*
+ * Lives in the first page of the mapping. Each side's position is on its own cache line.
+ * A side that is about to sleep sets its `waiting` flag, then checks the other position
+ * once more; the other side bumps the sequence number after moving its position, and
+ * only makes the wake-up syscall if the flag is set.
+ */
+struct SharedRing::Control {
+
+    alignas(64) std::atomic<std::uint64_t> head; // bytes written
+    std::atomic<std::uint32_t> data_seq;
+    std::atomic<std::uint32_t> consumer_waiting;
+
+    alignas(64) std::atomic<std::uint64_t> tail; // bytes released
+    std::atomic<std::uint32_t> space_seq;
+    std::atomic<std::uint32_t> producer_waiting;
+
+    alignas(64) std::uint64_t capacity;
+
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+
+SharedRing::SharedRing(std::size_t cap) :
+    owner{true}
+{
+    capacity = std::bit_ceil(std::max<std::size_t>(cap, 4096));
+
+    mem_fd = ::memfd_create("lssecrets-ring", 0);
+    if (mem_fd == -1)
+        throw_errno("memfd_create()");
+    if (::ftruncate(mem_fd, control_size + capacity) == -1) {
+        int e = errno;
+        ::close(mem_fd);
+        throw std::system_error{e, std::generic_category(), "ftruncate()"};
+    }
+
+    try {
+        map();
+    }
+    catch (...) {
+        ::close(mem_fd);
+        throw;
+    }
+
+    // the memory file starts zeroed, so both positions and sequences start at 0
+    control->capacity = capacity;
+}
+
+
+SharedRing::SharedRing(int fd,
+                       bool owner) :
+    mem_fd{fd},
+    owner{owner}
+{
+    try {
+        struct stat st;
+        if (::fstat(fd, &st) == -1)
+            throw_errno("fstat()");
+        if (st.st_size <= static_cast<off_t>(control_size))
+            throw std::runtime_error{"Invalid ring."};
+        capacity = st.st_size - control_size;
+        if (!std::has_single_bit(capacity))
+            throw std::runtime_error{"Invalid ring."};
+        map();
+        if (control->capacity != capacity)
+            throw std::runtime_error{"Invalid ring."};
+    }
+    catch (...) {
+        if (control)
+            ::munmap(control, control_size + capacity);
+        ::close(fd);
+        throw;
+    }
+}
+
+
+SharedRing
+SharedRing::attach(int fd)
+{
+    return SharedRing{fd, false};
+}
+
+
+SharedRing::~SharedRing()
+{
+    if (control) {
+        // wipe any secrets still in the ring
+        if (owner)
+            ::explicit_bzero(data, capacity);
+        ::munlock(control, control_size + capacity);
+        ::munmap(control, control_size + capacity);
+    }
+    if (mem_fd != -1)
+        ::close(mem_fd);
+}
+
+
+void
+SharedRing::map()
+{
+    static_assert(sizeof(Control) <= control_size);
+
+    void* addr = ::mmap(nullptr,
+                        control_size + capacity,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        mem_fd,
+                        0);
+    if (addr == MAP_FAILED)
+        throw_errno("mmap()");
+    // best effort, like SecureBuffer
+    ::mlock(addr, control_size + capacity);
+    ::madvise(addr, control_size + capacity, MADV_DONTDUMP);
+
+    control = static_cast<Control*>(addr);
+    data = static_cast<unsigned char*>(addr) + control_size;
+}
+
+
+bool
+SharedRing::fits(std::initializer_list<std::string_view> fields)
+    const noexcept
+{
+    return record_size(fields) <= capacity / 2;
+}
+
+
+void
+SharedRing::write(std::uint32_t type,
+                  std::initializer_list<std::string_view> fields)
+{
+    if (fields.size() > max_fields)
+        throw std::logic_error{"Too many fields in ring record."};
+
+    std::size_t size = record_size(fields);
+    if (size > capacity / 2)
+        throw std::runtime_error{"Record too large for the ring ("
+                                 + std::to_string(size) + " bytes)."};
+
+    std::uint64_t head = control->head.load(std::memory_order_relaxed);
+    std::size_t offset = head & (capacity - 1);
+    std::size_t contiguous = capacity - offset;
+    std::size_t needed = size <= contiguous ? size : contiguous + size;
+
+    // wait for space
+    while (capacity - (head - control->tail.load(std::memory_order_acquire)) < needed) {
+        std::uint32_t seq = control->space_seq.load();
+        control->producer_waiting.store(1);
+        if (capacity - (head - control->tail.load()) >= needed) {
+            control->producer_waiting.store(0);
+            break;
+        }
+        futex_wait(control->space_seq, seq, nullptr);
+        control->producer_waiting.store(0);
+    }
+
+    if (size > contiguous) {
+        RecordHeader pad{static_cast<std::uint32_t>(contiguous), pad_type, 0, 0};
+        std::memcpy(data + offset, &pad, sizeof pad);
+        head += contiguous;
+        offset = 0;
+    }
+
+    RecordHeader header{static_cast<std::uint32_t>(size),
+                        type,
+                        static_cast<std::uint32_t>(fields.size()),
+                        0};
+    unsigned char* out = data + offset;
+    std::memcpy(out, &header, sizeof header);
+    out += sizeof header;
+    for (auto& f : fields) {
+        std::uint32_t len = f.size();
+        std::memcpy(out, &len, sizeof len);
+        out += sizeof len;
+        std::memcpy(out, f.data(), len);
+        out += len;
+    }
+
+    control->head.store(head + size, std::memory_order_release);
+    control->data_seq.fetch_add(1);
+    if (control->consumer_waiting.load())
+        futex_wake(control->data_seq);
+}
+
+
+const SharedRing::Record*
+SharedRing::read(std::chrono::milliseconds timeout)
+{
+    std::uint64_t tail = control->tail.load(std::memory_order_relaxed);
+
+    while (control->head.load(std::memory_order_acquire) == tail) {
+        std::uint32_t seq = control->data_seq.load();
+        control->consumer_waiting.store(1);
+        if (control->head.load() != tail) {
+            control->consumer_waiting.store(0);
+            break;
+        }
+        auto s = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - s);
+        timespec ts{static_cast<time_t>(s.count()), static_cast<long>(ns.count())};
+        futex_wait(control->data_seq, seq, &ts);
+        control->consumer_waiting.store(0);
+        if (control->head.load(std::memory_order_acquire) == tail)
+            return nullptr;
+    }
+
+    RecordHeader header;
+    std::memcpy(&header, data + (tail & (capacity - 1)), sizeof header);
+    if (header.type == pad_type) {
+        // padding is always followed by a record, published together with it
+        tail += header.size;
+        std::memcpy(&header, data + (tail & (capacity - 1)), sizeof header);
+    }
+
+    const unsigned char* in = data + (tail & (capacity - 1)) + sizeof header;
+
+    current.type = header.type;
+    current.num_fields = std::min<unsigned>(header.num_fields, max_fields);
+    for (unsigned i = 0; i < current.num_fields; ++i) {
+        std::uint32_t len;
+        std::memcpy(&len, in, sizeof len);
+        in += sizeof len;
+        current.fields[i] = {reinterpret_cast<const char*>(in), len};
+        in += len;
+    }
+
+    current_end = tail + header.size;
+    return &current;
+}
+
+
+void
+SharedRing::release()
+{
+    control->tail.store(current_end, std::memory_order_release);
+    control->space_seq.fetch_add(1);
+    if (control->producer_waiting.load())
+        futex_wake(control->space_seq);
+}
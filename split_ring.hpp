@@ -0,0 +1,114 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SPLIT_RING_HPP
+#define SPLIT_RING_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string_view>
+
+
+/*
+ * Single-producer, single-consumer ring of variable-size records, in shared memory that
+ * is locked in RAM. One process writes records, another reads them in place; the only
+ * synchronization is a pair of atomic positions, and a futex to sleep on when the ring
+ * is empty or full.
+ *
+ * A record is a type and up to `max_fields` byte strings. A record that doesn't fit
+ * before the end of the ring is preceded by padding, so records are always contiguous.
+ */
+class SharedRing {
+public:
+
+    static constexpr std::size_t default_capacity = 8 << 20;
+    static constexpr unsigned max_fields = 8;
+
+
+    struct Record {
+        std::uint32_t type;
+        unsigned num_fields;
+        std::array<std::string_view, max_fields> fields;
+    };
+
+
+    // Creates a ring in a new memory file, which the other process must attach().
+    explicit
+    SharedRing(std::size_t capacity = default_capacity);
+
+
+    SharedRing(const SharedRing&) = delete;
+
+
+    ~SharedRing();
+
+
+    static
+    SharedRing
+    attach(int fd);
+
+
+    int
+    fd()
+        const noexcept
+    {
+        return mem_fd;
+    }
+
+
+    // Whether a record with these fields is small enough for write(): half the ring.
+    bool
+    fits(std::initializer_list<std::string_view> fields)
+        const noexcept;
+
+
+    // Producer: blocks while the ring is full.
+    void
+    write(std::uint32_t type,
+          std::initializer_list<std::string_view> fields);
+
+
+    /*
+     * Consumer: returns the oldest record, or nullptr if none arrived within the timeout.
+     * The record stays valid, and its space reserved, until release().
+     */
+    const Record*
+    read(std::chrono::milliseconds timeout);
+
+
+    void
+    release();
+
+private:
+
+    struct Control;
+
+
+    SharedRing(int fd,
+               bool owner);
+
+
+    void
+    map();
+
+
+    int mem_fd = -1;
+    bool owner;
+    Control* control = nullptr;
+    unsigned char* data = nullptr;
+    std::size_t capacity = 0;
+
+    Record current;
+    std::uint64_t current_end = 0; // position after the record being read
+
+};
+
+
+#endif
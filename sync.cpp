@@ -0,0 +1,392 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <array>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "sync.hpp"
+#include "pipeline.hpp"
+#include "utils.hpp"
+
+
+using namespace std::literals;
+
+
+namespace {
+
+
+    using Digest = std::array<guint8, 32>;
+
+
+    using ValuePtr = std::shared_ptr<SecretValue>;
+
+
+    struct Entry {
+        GObjectWrapper<SecretItem> item;
+        std::string collection_label;
+        std::string label;
+        std::map<std::string, std::string> attributes;
+        std::optional<Digest> digest; // empty if the secret couldn't be loaded
+        ValuePtr value;
+    };
+
+
+    struct Side {
+        std::string name;
+        std::string bus_name;
+        GObjectWrapper<SecretService> service;
+        GError* open_error = nullptr;
+        bool opened = false;
+
+        // by path, since labels needn't be unique
+        std::map<std::string, GObjectWrapper<SecretCollection>> collections;
+        std::map<std::string, std::string> labels;
+        // the first collection with each label, where items are created
+        std::map<std::string, GObjectWrapper<SecretCollection>> by_label;
+        std::vector<GObjectWrapper<SecretItem>> items;
+        GError* load_error = nullptr;
+        bool loaded = false;
+
+        std::map<std::string, std::vector<Entry>> entries;
+    };
+
+
+    void
+    on_opened(GObject*,
+              GAsyncResult* result,
+              gpointer data)
+    {
+        auto& side = *static_cast<Side*>(data);
+        side.service = take(secret_service_open_finish(result, &side.open_error));
+        side.opened = true;
+    }
+
+
+    void
+    on_loaded(GObject*,
+              GAsyncResult* result,
+              gpointer data)
+    {
+        auto& side = *static_cast<Side*>(data);
+        secret_item_load_secrets_finish(result, &side.load_error);
+        side.loaded = true;
+    }
+
+
+    // Collects the items of a freshly opened service, unlocking them if asked to.
+    void
+    enumerate(Side& side,
+              bool unlock)
+    {
+        GList* locked = nullptr;
+        auto collections = to_vector<SecretCollection>(
+                               secret_service_get_collections(side.service));
+        for (auto& col : collections) {
+            if (unlock && secret_collection_get_locked(col))
+                locked = g_list_prepend(locked, col.get());
+            auto items = to_vector<SecretItem>(secret_collection_get_items(col));
+            for (auto& item : items) {
+                if (unlock && secret_item_get_locked(item))
+                    locked = g_list_prepend(locked, item.get());
+                side.items.push_back(std::move(item));
+            }
+            std::string path = g_dbus_proxy_get_object_path(col);
+            auto label = to_string(secret_collection_get_label(col)).value_or("");
+            side.labels.emplace(path, label);
+            side.by_label.try_emplace(label, col);
+            side.collections.emplace(std::move(path), col);
+        }
+
+        if (locked) {
+            GError* error = nullptr;
+            secret_service_unlock_sync(side.service, locked, nullptr, nullptr, &error);
+            g_list_free(locked);
+            if (error)
+                throw std::runtime_error{side.name + ": " + to_error(error).what()};
+            // let the proxies see the new Locked properties
+            while (g_main_context_iteration(nullptr, FALSE))
+                ;
+        }
+    }
+
+
+    GList*
+    unlocked_items(Side& side)
+    {
+        GList* list = nullptr;
+        for (auto& item : side.items)
+            if (!secret_item_get_locked(item))
+                list = g_list_prepend(list, item.get());
+        return g_list_reverse(list);
+    }
+
+
+    std::string
+    match_key(const Entry& e)
+    {
+        std::string key = e.collection_label;
+        key += '\0';
+        key += e.label;
+        key += '\0';
+        for (auto& [k, v] : e.attributes) {
+            key += k;
+            key += '\0';
+            key += v;
+            key += '\0';
+        }
+        return key;
+    }
+
+
+    void
+    index(Side& side,
+          const std::vector<guint8>& hmac_key)
+    {
+        for (auto& item : side.items) {
+            Entry e;
+            e.item = item;
+            auto col_path = std::string{g_dbus_proxy_get_object_path(item)};
+            col_path.erase(col_path.rfind('/'));
+            if (auto found = side.labels.find(col_path); found != side.labels.end())
+                e.collection_label = found->second;
+            e.label = to_string(secret_item_get_label(item)).value_or("");
+            e.attributes = to_map(secret_item_get_attributes(item));
+
+            if (auto val = secret_item_get_secret(item)) {
+                e.value = ValuePtr{val, secret_value_unref};
+                gsize len = 0;
+                auto ptr = secret_value_get(val, &len);
+                const char* type = secret_value_get_content_type(val);
+
+                GHmac* hmac = g_hmac_new(G_CHECKSUM_SHA256, hmac_key.data(), hmac_key.size());
+                g_hmac_update(hmac,
+                              reinterpret_cast<const guchar*>(type ? type : ""),
+                              -1);
+                g_hmac_update(hmac, reinterpret_cast<const guchar*>(""), 1);
+                g_hmac_update(hmac, reinterpret_cast<const guchar*>(ptr), len);
+                Digest d;
+                gsize d_len = d.size();
+                g_hmac_get_digest(hmac, d.data(), &d_len);
+                g_hmac_unref(hmac);
+                e.digest = d;
+            }
+
+            side.entries[match_key(e)].push_back(std::move(e));
+        }
+    }
+
+
+    std::string
+    describe(const Entry& e)
+    {
+        return "\""s + e.collection_label + "\" / \"" + e.label + "\"";
+    }
+
+
+} // namespace
+
+
+void
+sync_services(const SyncOptions& options,
+              std::ostream& out)
+{
+    if (options.from_bus == options.to_bus)
+        throw std::runtime_error{"Source and target services must be different."};
+
+    Side source;
+    source.name = "source";
+    source.bus_name = options.from_bus;
+    Side target;
+    target.name = "target";
+    target.bus_name = options.to_bus;
+
+    // Open both services concurrently.
+    auto flags = SecretServiceFlags(SECRET_SERVICE_OPEN_SESSION
+                                    | SECRET_SERVICE_LOAD_COLLECTIONS);
+    for (Side* side : {&source, &target})
+        secret_service_open(SECRET_TYPE_SERVICE,
+                            side->bus_name.empty() ? nullptr : side->bus_name.c_str(),
+                            flags,
+                            nullptr,
+                            on_opened,
+                            side);
+    while (!source.opened || !target.opened)
+        g_main_context_iteration(nullptr, TRUE);
+    for (Side* side : {&source, &target})
+        if (side->open_error)
+            throw std::runtime_error{side->name + ": " + to_error(side->open_error).what()};
+
+    for (Side* side : {&source, &target})
+        enumerate(*side, options.unlock);
+
+    // Load all secrets from both sides concurrently.
+    for (Side* side : {&source, &target}) {
+        GList* list = unlocked_items(*side);
+        if (!list) {
+            side->loaded = true;
+            continue;
+        }
+        secret_item_load_secrets(list, nullptr, on_loaded, side);
+        g_list_free(list);
+    }
+    while (!source.loaded || !target.loaded)
+        g_main_context_iteration(nullptr, TRUE);
+    for (Side* side : {&source, &target})
+        if (side->load_error)
+            throw std::runtime_error{side->name + ": " + to_error(side->load_error).what()};
+
+    std::vector<guint8> hmac_key(32);
+    std::random_device rng;
+    for (auto& b : hmac_key)
+        b = rng();
+    index(source, hmac_key);
+    index(target, hmac_key);
+
+    // Plan the changes.
+    std::vector<const Entry*> to_create;
+    std::vector<std::pair<const Entry*, const Entry*>> to_update;
+    std::vector<const Entry*> to_delete;
+    std::size_t unchanged = 0;
+    std::size_t skipped = 0;
+    std::size_t failed = 0;
+
+    for (auto& [key, src_entries] : source.entries) {
+        static const std::vector<Entry> none;
+        auto found = target.entries.find(key);
+        auto& dst_entries = found != target.entries.end() ? found->second : none;
+
+        std::size_t i = 0;
+        for (; i < src_entries.size() && i < dst_entries.size(); ++i) {
+            auto& src = src_entries[i];
+            auto& dst = dst_entries[i];
+            if (!src.digest || !dst.digest)
+                ++skipped;
+            else if (*src.digest == *dst.digest)
+                ++unchanged;
+            else
+                to_update.emplace_back(&src, &dst);
+        }
+        for (; i < src_entries.size(); ++i) {
+            if (src_entries[i].digest)
+                to_create.push_back(&src_entries[i]);
+            else
+                ++skipped;
+        }
+        for (; i < dst_entries.size(); ++i)
+            to_delete.push_back(&dst_entries[i]);
+    }
+    for (auto& [key, dst_entries] : target.entries)
+        if (!source.entries.contains(key))
+            for (auto& dst : dst_entries)
+                to_delete.push_back(&dst);
+
+    if (options.dry_run) {
+        for (auto e : to_create)
+            out << "Create: " << describe(*e) << '\n';
+        for (auto [src, dst] : to_update)
+            out << "Update: " << describe(*dst) << '\n';
+        for (auto e : to_delete)
+            out << "Delete: " << describe(*e) << '\n';
+    } else {
+        // Collections are few, create the missing ones before pipelining the items.
+        for (auto e : to_create) {
+            if (target.by_label.contains(e->collection_label))
+                continue;
+            GError* error = nullptr;
+            auto col = take(secret_collection_create_sync(target.service,
+                                                          e->collection_label.c_str(),
+                                                          nullptr,
+                                                          SECRET_COLLECTION_CREATE_NONE,
+                                                          nullptr,
+                                                          &error));
+            if (error)
+                throw std::runtime_error{"Couldn't create collection \""
+                                         + e->collection_label + "\": "
+                                         + to_error(error).what()};
+            target.by_label.emplace(e->collection_label, std::move(col));
+        }
+
+        Pipeline pipeline{options.jobs};
+
+        for (auto e : to_create) {
+            auto col = target.by_label.at(e->collection_label);
+            auto value = e->value;
+            auto attributes = e->attributes;
+            auto label = e->label;
+            pipeline.add("Create " + describe(*e),
+                         [col, value, attributes, label](GAsyncReadyCallback cb,
+                                                         gpointer data) mutable
+                         {
+                             GHashTable* table = to_hash_table(attributes);
+                             secret_item_create(col,
+                                                nullptr,
+                                                table,
+                                                label.c_str(),
+                                                value.get(),
+                                                SECRET_ITEM_CREATE_NONE,
+                                                nullptr,
+                                                cb,
+                                                data);
+                             g_hash_table_unref(table);
+                         },
+                         [](GObject*, GAsyncResult* result, GError** error)
+                         {
+                             auto item = take(secret_item_create_finish(result, error));
+                             return item.get() != nullptr;
+                         });
+        }
+
+        for (auto [src, dst] : to_update) {
+            auto item = dst->item;
+            auto value = src->value;
+            pipeline.add("Update " + describe(*dst),
+                         [item, value](GAsyncReadyCallback cb, gpointer data) mutable
+                         {
+                             secret_item_set_secret(item, value.get(), nullptr, cb, data);
+                         },
+                         [item](GObject*, GAsyncResult* result, GError** error) mutable
+                         {
+                             return bool(secret_item_set_secret_finish(item, result, error));
+                         });
+        }
+
+        for (auto e : to_delete) {
+            auto item = e->item;
+            pipeline.add("Delete " + describe(*e),
+                         [item](GAsyncReadyCallback cb, gpointer data) mutable
+                         {
+                             secret_item_delete(item, nullptr, cb, data);
+                         },
+                         [item](GObject*, GAsyncResult* result, GError** error) mutable
+                         {
+                             return bool(secret_item_delete_finish(item, result, error));
+                         });
+        }
+
+        pipeline.run();
+
+        for (auto& msg : pipeline.get_errors())
+            out << "Error: " << msg << '\n';
+        failed = pipeline.get_errors().size();
+    }
+
+    out << "Created: " << to_create.size() << '\n'
+        << "Updated: " << to_update.size() << '\n'
+        << "Deleted: " << to_delete.size() << '\n'
+        << "Unchanged: " << unchanged << '\n';
+    if (skipped)
+        out << "Skipped (locked): " << skipped << '\n';
+
+    if (failed)
+        throw std::runtime_error{std::to_string(failed) + " of the changes failed."};
+}
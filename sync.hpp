@@ -0,0 +1,38 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SYNC_HPP
+#define SYNC_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+
+struct SyncOptions {
+    std::string from_bus;       // D-Bus name of the source service; empty for the default
+    std::string to_bus;         // D-Bus name of the target service; empty for the default
+    bool unlock = false;        // unlock locked collections and items on both sides
+    bool dry_run = false;       // only print the changes
+    std::size_t jobs = 32;      // max calls in flight on the target
+};
+
+
+/*
+ * Makes the target service's items match the source's.
+ *
+ * Items are matched by collection label, item label and attributes. Secrets are compared
+ * through keyed digests, so they are never printed. Only missing, different or extra
+ * items are created, updated or deleted on the target. Throws after the report if any
+ * change failed.
+ */
+void
+sync_services(const SyncOptions& options,
+              std::ostream& out);
+
+
+#endif
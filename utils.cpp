@@ -0,0 +1,201 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+
+#include <glibmm/error.h>
+
+#include "utils.hpp"
+
+
+using namespace std::literals;
+
+
+std::optional<std::string>
+to_string(gchar* s)
+{
+    if (!s)
+        return {};
+
+    std::string result = s;
+    g_free(s);
+    return result;
+}
+
+
+std::optional<std::string>
+to_string(const gchar* s)
+{
+    if (!s)
+        return {};
+
+    std::string result = s;
+    return result;
+}
+
+
+std::map<std::string, std::string>
+to_map(GHashTable* table)
+{
+    try {
+        std::map<std::string, std::string> result;
+
+        GHashTableIter iter;
+        gpointer key, val;
+        g_hash_table_iter_init(&iter, table);
+        while (g_hash_table_iter_next(&iter, &key, &val)) {
+            std::string key_s = reinterpret_cast<const char*>(key);
+            std::string val_s = reinterpret_cast<const char*>(val);
+            result[key_s] = val_s;
+        }
+        g_hash_table_unref(table);
+
+        return result;
+    }
+    catch (...) {
+        g_hash_table_unref(table);
+        throw;
+    }
+}
+
+
+void
+sorted_entries(GHashTable* table,
+               std::vector<std::pair<std::string_view, std::string_view>>& entries)
+{
+    entries.clear();
+    GHashTableIter iter;
+    gpointer key, val;
+    g_hash_table_iter_init(&iter, table);
+    while (g_hash_table_iter_next(&iter, &key, &val))
+        entries.emplace_back(reinterpret_cast<const char*>(key),
+                             reinterpret_cast<const char*>(val));
+    std::sort(entries.begin(), entries.end());
+}
+
+
+std::vector<std::string>
+get_object_paths(GDBusProxy* proxy,
+                 const char* property)
+{
+    std::vector<std::string> result;
+    GVariant* paths = g_dbus_proxy_get_cached_property(proxy, property);
+    if (!paths)
+        return result;
+
+    gsize n = 0;
+    const gchar** objv = g_variant_get_objv(paths, &n);
+    result.assign(objv, objv + n);
+    g_free(objv);
+    g_variant_unref(paths);
+    return result;
+}
+
+
+bool
+is_text_secret(std::string_view content_type,
+               std::string_view data)
+    noexcept
+{
+    if (!content_type.empty()
+        && content_type != "text/plain"
+        && content_type != "application/octet-stream")
+        return false;
+    // with an explicit length, nulls are rejected too
+    return g_utf8_validate(data.data(), data.size(), nullptr);
+}
+
+
+GHashTable*
+to_hash_table(const std::map<std::string, std::string>& attributes)
+{
+    GHashTable* table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    for (auto& [key, val] : attributes)
+        g_hash_table_insert(table, g_strdup(key.c_str()), g_strdup(val.c_str()));
+    return table;
+}
+
+
+
+const char*
+describe_error(GQuark domain,
+               int code)
+    noexcept
+{
+    if (domain != SECRET_ERROR)
+        return "Couldn't get secret service.";
+
+    switch (code) {
+    case SECRET_ERROR_PROTOCOL:
+        return "Received invalid data from secret service.";
+    case SECRET_ERROR_IS_LOCKED:
+        return "Secret item or collection is locked.";
+    case SECRET_ERROR_NO_SUCH_OBJECT:
+        return "Secret item or collection not found.";
+    case SECRET_ERROR_ALREADY_EXISTS:
+        return "Secret item or collection already exists.";
+    default:
+        return "";
+    }
+}
+
+
+std::runtime_error
+to_error(GError* raw_err)
+{
+    Glib::Error err{raw_err}; // will free raw_err on destructor
+
+    std::string msg = describe_error(err.domain(), err.code());
+
+    msg += " "s + err.what();
+
+    return std::runtime_error{msg};
+}
+
+
+void
+append_json_string(std::string& out,
+                   std::string_view s)
+{
+    static const char digits[] = "0123456789abcdef";
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out += "\\u00";
+                out += digits[(c >> 4) & 0xf];
+                out += digits[c & 0xf];
+            } else
+                out += c;
+        }
+    }
+    out += '"';
+}
+
+
+[[noreturn]]
+void
+throw_error(GError* raw_err)
+{
+    throw to_error(raw_err);
+}
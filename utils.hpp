@@ -0,0 +1,227 @@
+/*
+ * lssecrets - A tool to list data from the keyring.
+ * Copyright 2024  Daniel K. O. (dkosmari)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef UTILS_HPP
+#define UTILS_HPP
+
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <libsecret-1/libsecret/secret.h>
+
+
+template<typename T>
+class GObjectWrapper {
+    T* ptr = nullptr;
+
+public:
+
+    GObjectWrapper() noexcept = default;
+
+
+    explicit
+    GObjectWrapper(T* p, bool add_ref = false)
+        noexcept :
+        ptr{p}
+    {
+        if (add_ref)
+            ref();
+    }
+
+
+    GObjectWrapper(const GObjectWrapper& other)
+        noexcept :
+        ptr{other.ptr}
+    {
+        ref();
+    }
+
+
+    GObjectWrapper(GObjectWrapper&& other)
+        noexcept :
+        ptr{other.ptr}
+    {
+        other.ptr = nullptr;
+    }
+
+
+    GObjectWrapper&
+    operator =(const GObjectWrapper& other)
+        noexcept
+    {
+        unref();
+        ptr = other.ptr;
+        ref();
+        return *this;
+    }
+
+
+    GObjectWrapper&
+    operator =(GObjectWrapper&& other)
+        noexcept
+    {
+        unref();
+        ptr = other.ptr;
+        other.ptr = nullptr;
+        return *this;
+    }
+
+
+    ~GObjectWrapper()
+    {
+        unref();
+    }
+
+
+    void
+    ref()
+    {
+        if (ptr)
+            g_object_ref(ptr);
+    }
+
+
+    void
+    unref()
+    {
+        if (ptr)
+            g_object_unref(ptr);
+    }
+
+
+    T*
+    get()
+        noexcept
+    {
+        return ptr;
+    }
+
+
+    operator T* ()
+        noexcept
+    {
+        return get();
+    }
+
+
+    operator GDBusProxy* ()
+        noexcept
+    {
+        return G_DBUS_PROXY(get());
+    }
+
+
+};
+
+
+template<typename T>
+GObjectWrapper<T>
+take(T* obj)
+{
+    return GObjectWrapper<T>{obj, false};
+}
+
+
+template<typename T>
+GObjectWrapper<T>
+borrow(T* obj)
+{
+    return GObjectWrapper<T>{obj, true};
+}
+
+
+template<typename T>
+std::vector<GObjectWrapper<T>>
+to_vector(GList* list)
+{
+    std::vector<GObjectWrapper<T>> result;
+
+    try {
+        for (GList* n = list; n; n = n->next) {
+            T* ptr = reinterpret_cast<T*>(n->data);
+            n->data = nullptr;
+            result.push_back(take(ptr));
+        }
+        g_list_free(list);
+    }
+    catch (...) {
+        g_list_free_full(list, g_object_unref);
+        throw;
+    }
+
+    return result;
+}
+
+
+std::optional<std::string>
+to_string(gchar* s);
+
+
+std::optional<std::string>
+to_string(const gchar* s);
+
+
+std::map<std::string, std::string>
+to_map(GHashTable* table);
+
+
+// Fills entries with the strings in the table, sorted by key; they point into the table.
+void
+sorted_entries(GHashTable* table,
+               std::vector<std::pair<std::string_view, std::string_view>>& entries);
+
+
+// Returns a new table of strings, in the form libsecret takes attributes.
+GHashTable*
+to_hash_table(const std::map<std::string, std::string>& attributes);
+
+
+// The object paths in an "ao" property of the proxy, as last received.
+std::vector<std::string>
+get_object_paths(GDBusProxy* proxy,
+                 const char* property);
+
+
+/*
+ * Whether a secret is shown as text: text/plain, or no content type or
+ * application/octet-stream (as old gnome-keyring versions return passwords), as long as
+ * the bytes are valid UTF-8 without nulls.
+ */
+bool
+is_text_secret(std::string_view content_type,
+               std::string_view data)
+    noexcept;
+
+
+// Short explanation for an error from libsecret.
+const char*
+describe_error(GQuark domain,
+               int code)
+    noexcept;
+
+
+std::runtime_error
+to_error(GError* raw_err);
+
+
+[[noreturn]]
+void
+throw_error(GError* raw_err);
+
+
+// Appends s as a quoted and escaped JSON string.
+void
+append_json_string(std::string& out,
+                   std::string_view s);
+
+
+#endif